@@ -1,10 +1,27 @@
 #version 330 core
 layout (location = 0) in vec3 vp;
+// Per instance (per bird) attributes
+layout (location = 1) in vec4 bird_pos;
+layout (location = 2) in vec4 bird_dir;
+layout (location = 3) in vec4 prev_bird_pos;
+layout (location = 4) in vec4 prev_bird_dir;
+layout (location = 5) in uint flock_index;
 
-uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
+uniform float alpha; // interpolation from the previous to the current tick, 1 draws the current tick
+uniform vec3 flock_colors[7];
+
+out vec3 color;
 
 void main() {
-  gl_Position = projection * view * model * vec4(vp, 1.0);
-};
\ No newline at end of file
+  vec3 pos = mix(prev_bird_pos.xyz, bird_pos.xyz, alpha);
+  vec3 dir = mix(prev_bird_dir.xyz, bird_dir.xyz, alpha);
+  // Rotate the triangle around z to face the bird's direction, then move it to the bird's position
+  float angle = atan(dir.y, dir.x);
+  float c = cos(angle);
+  float s = sin(angle);
+  vec3 world_pos = vec3(c * vp.x - s * vp.y, s * vp.x + c * vp.y, vp.z) + pos;
+  color = flock_colors[flock_index % 7u];
+  gl_Position = projection * view * vec4(world_pos, 1.0);
+};
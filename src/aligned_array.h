@@ -0,0 +1,49 @@
+#pragma once
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#if defined(_WIN32)
+#include <malloc.h>
+#endif
+
+// Zero initialized heap array of trivially copyable elements, aligned to alignment bytes (a power of two,
+// at least sizeof(void*)). Converts to a plain pointer so it can be handed to memcpy, OpenCL and OpenGL as is.
+template <typename T, size_t alignment = 64>
+struct AlignedArray {
+  T* data = nullptr;
+  size_t size = 0;
+
+  AlignedArray() = default;
+  AlignedArray(const AlignedArray&) = delete;
+  AlignedArray& operator=(const AlignedArray&) = delete;
+  ~AlignedArray() { Free(); }
+
+  void Allocate(size_t count) {
+    Free();
+    size_t bytes = (sizeof(T) * count + alignment - 1) / alignment * alignment;
+#if defined(_WIN32)
+    data = static_cast<T*>(_aligned_malloc(bytes, alignment));
+#else
+    void* memory = nullptr;
+    data = posix_memalign(&memory, alignment, bytes) == 0 ? static_cast<T*>(memory) : nullptr;
+#endif
+    if (data == nullptr) {
+      throw std::bad_alloc();
+    }
+    std::memset(data, 0, bytes);
+    size = count;
+  }
+
+  void Free() {
+#if defined(_WIN32)
+    _aligned_free(data);
+#else
+    free(data);
+#endif
+    data = nullptr;
+    size = 0;
+  }
+
+  operator T*() { return data; }
+  operator const T*() const { return data; }
+};
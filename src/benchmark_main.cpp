@@ -0,0 +1,366 @@
+// Benchmark of the simulation backends over a matrix of scenarios, without a window or OpenGL context.
+// Every scenario simulates warmup ticks, then times reps ticks one by one. A tick is a step, the fetch of
+// its birds into the state and a blocking commit, so it includes the device's execution time. With the
+// two-device pipeline the flock averages on the second device are timed separately.
+//
+//   bird-flock-benchmark --birds 1000,4000,16000 --flocks 1,7 --backends opencl,native,native-scalar
+//     --pipelines single,two-device --warmup 20 --reps 200 --json results.json --csv results.csv
+//
+// Backends are opencl, native (widest SIMD the CPU supports) or native-scalar/-sse/-avx2/-avx512.
+// The two-device pipeline only applies to opencl, other backends run the single pipeline only.
+// --cl-profile prints the device side durations of the OpenCL commands of each scenario, at some cost to its timings.
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cmath>
+#include "simulation_state.h"
+#include "opencl_backend.h"
+#include "native_backend.h"
+#include "stage_timings.h"
+
+using std::string;
+using std::vector;
+using std::cout;
+using std::endl;
+
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+
+struct Scenario {
+  string backend;
+  string pipeline;
+  int birds = 0;
+  int flocks = 0;
+};
+
+// Tick times of a scenario in milliseconds
+struct Summary {
+  double median = 0;
+  double p99 = 0;
+  double mean = 0;
+  double min = 0;
+  double max = 0;
+};
+
+struct Result {
+  Scenario scenario;
+  string backend_name; // as reported by the backend, with the SIMD level or device
+  string status = "ok"; // or why the scenario didn't run
+  int simulated_birds = 0;
+  Summary tick;
+  bool has_flock_averages = false;
+  Summary flock_averages;
+  StageTimings stages;
+};
+
+vector<string> SplitList(const string& list) {
+  vector<string> items;
+  std::stringstream stream(list);
+  string item;
+  while (std::getline(stream, item, ',')) {
+    if (!item.empty()) {
+      items.push_back(item);
+    }
+  }
+  return items;
+}
+
+vector<int> SplitIntList(const string& list) {
+  vector<int> values;
+  for (const string& item : SplitList(list)) {
+    values.push_back(std::stoi(item));
+  }
+  return values;
+}
+
+// Nearest rank percentiles
+Summary Summarize(vector<double> milliseconds) {
+  Summary summary;
+  if (milliseconds.empty()) {
+    return summary;
+  }
+  std::sort(milliseconds.begin(), milliseconds.end());
+  size_t n = milliseconds.size();
+  summary.median = n % 2 == 1 ? milliseconds[n / 2] : (milliseconds[n / 2 - 1] + milliseconds[n / 2]) / 2;
+  summary.p99 = milliseconds[std::max<size_t>(1, (size_t)std::ceil(0.99 * n)) - 1];
+  double total = 0;
+  for (double value : milliseconds) {
+    total += value;
+  }
+  summary.mean = total / n;
+  summary.min = milliseconds.front();
+  summary.max = milliseconds.back();
+  return summary;
+}
+
+double MillisecondsSince(clock_type::time_point start) {
+  return std::chrono::duration<double, std::milli>(clock_type::now() - start).count();
+}
+
+string JsonString(const string& value) {
+  string escaped = "\"";
+  for (char c : value) {
+    if (c == '"' || c == '\\') {
+      escaped += '\\';
+    }
+    escaped += c;
+  }
+  return escaped + "\"";
+}
+
+void WriteSummaryJson(std::ostream& out, const Summary& summary) {
+  out << "{ \"median_ms\": " << summary.median << ", \"p99_ms\": " << summary.p99 << ", \"mean_ms\": " << summary.mean
+    << ", \"min_ms\": " << summary.min << ", \"max_ms\": " << summary.max << " }";
+}
+
+void WriteJson(std::ostream& out, const vector<Result>& results, int warmup, int reps) {
+  out << "{" << endl << "  \"warmup\": " << warmup << "," << endl << "  \"reps\": " << reps << "," << endl << "  \"results\": [" << endl;
+  for (size_t i = 0; i < results.size(); ++i) {
+    const Result& result = results[i];
+    out << "    { \"backend\": " << JsonString(result.scenario.backend) << ", \"backend_name\": " << JsonString(result.backend_name)
+      << ", \"pipeline\": " << JsonString(result.scenario.pipeline) << ", \"birds\": " << result.scenario.birds
+      << ", \"simulated_birds\": " << result.simulated_birds << ", \"flocks\": " << result.scenario.flocks
+      << ", \"status\": " << JsonString(result.status);
+    if (result.status == "ok") {
+      out << "," << endl << "      \"tick\": ";
+      WriteSummaryJson(out, result.tick);
+      if (result.has_flock_averages) {
+        out << "," << endl << "      \"flock_averages\": ";
+        WriteSummaryJson(out, result.flock_averages);
+      }
+      out << "," << endl << "      \"stages_mean_ms\": {";
+      for (size_t s = 0; s < result.stages.stages.size(); ++s) {
+        const StageTimings::Stage& stage = result.stages.stages[s];
+        out << (s > 0 ? ", " : " ") << JsonString(stage.name) << ": " << stage.total / stage.count * 1000;
+      }
+      out << " }";
+    }
+    out << " }" << (i + 1 < results.size() ? "," : "") << endl;
+  }
+  out << "  ]" << endl << "}" << endl;
+}
+
+void WriteCsv(std::ostream& out, const vector<Result>& results) {
+  out << "backend,backend_name,pipeline,birds,simulated_birds,flocks,status,tick_median_ms,tick_p99_ms,tick_mean_ms,tick_min_ms,tick_max_ms,avgs_median_ms,avgs_p99_ms" << endl;
+  for (const Result& result : results) {
+    out << result.scenario.backend << "," << result.backend_name << "," << result.scenario.pipeline << "," << result.scenario.birds << ","
+      << result.simulated_birds << "," << result.scenario.flocks << "," << result.status;
+    if (result.status == "ok") {
+      out << "," << result.tick.median << "," << result.tick.p99 << "," << result.tick.mean << "," << result.tick.min << "," << result.tick.max;
+      if (result.has_flock_averages) {
+        out << "," << result.flock_averages.median << "," << result.flock_averages.p99;
+      }
+      else {
+        out << ",,";
+      }
+    }
+    else {
+      out << ",,,,,,,";
+    }
+    out << endl;
+  }
+}
+
+}
+
+int main(int argc, char* argv[]) {
+  vector<int> bird_counts = { 1000, 4004, 16000 };
+  vector<int> flock_counts = { SimulationState::max_flocks };
+  vector<string> backends = { "opencl", "native" };
+  vector<string> pipelines = { "single" };
+  int warmup = 20;
+  int reps = 200;
+  float delta_time = 1.0f / 30.0f;
+  string json_path;
+  string csv_path;
+  string kernel_cache_directory = "kernel_cache";
+  bool benchmark_devices = true;
+  int requested_device = -1;
+  bool profile_commands = false;
+  for (int i = 1; i < argc; ++i) {
+    string arg = argv[i];
+    if (arg == "--birds" && i + 1 < argc) {
+      bird_counts = SplitIntList(argv[++i]);
+    }
+    else if (arg == "--flocks" && i + 1 < argc) {
+      flock_counts = SplitIntList(argv[++i]);
+    }
+    else if (arg == "--backends" && i + 1 < argc) {
+      backends = SplitList(argv[++i]);
+    }
+    else if (arg == "--pipelines" && i + 1 < argc) {
+      pipelines = SplitList(argv[++i]);
+    }
+    else if (arg == "--warmup" && i + 1 < argc) {
+      warmup = std::max(0, std::stoi(argv[++i]));
+    }
+    else if (arg == "--reps" && i + 1 < argc) {
+      reps = std::max(1, std::stoi(argv[++i]));
+    }
+    else if (arg == "--dt" && i + 1 < argc) {
+      delta_time = std::stof(argv[++i]);
+    }
+    else if (arg == "--json" && i + 1 < argc) {
+      json_path = argv[++i];
+    }
+    else if (arg == "--csv" && i + 1 < argc) {
+      csv_path = argv[++i];
+    }
+    else if (arg == "--kernel-cache" && i + 1 < argc) {
+      kernel_cache_directory = argv[++i];
+    }
+    else if (arg == "--no-kernel-cache") {
+      kernel_cache_directory.clear();
+    }
+    else if (arg == "--no-device-benchmark") {
+      benchmark_devices = false;
+    }
+    else if (arg == "--cl-device" && i + 1 < argc) {
+      requested_device = std::stoi(argv[++i]);
+    }
+    else if (arg == "--cl-profile") {
+      profile_commands = true;
+    }
+    else {
+      std::cerr << "Unknown argument " << arg << endl;
+      return 1;
+    }
+  }
+
+  for (const string& backend : backends) {
+    SimdLevel simd_level;
+    if (backend.compare(0, 7, "native-") == 0 && !ParseSimdLevel(backend.substr(7).c_str(), simd_level)) {
+      std::cerr << "Unknown backend " << backend << ", native-<level> expects scalar, sse, avx2 or avx512" << endl;
+      return 1;
+    }
+  }
+
+  // Devices are scored once and shared by every OpenCL scenario, so are the built kernels
+  vector<DeviceCandidate> devices;
+  ProgramCache program_cache;
+  program_cache.binary_directory = kernel_cache_directory;
+  if (std::find(backends.begin(), backends.end(), "opencl") != backends.end()) {
+    devices = FindDevices(benchmark_devices);
+    PrintDevices(devices, AssignDevices(devices, requested_device, false));
+  }
+
+  vector<Scenario> scenarios;
+  for (const string& backend : backends) {
+    for (const string& pipeline : pipelines) {
+      if (pipeline != "single" && backend != "opencl") {
+        continue;
+      }
+      for (int flocks : flock_counts) {
+        for (int birds : bird_counts) {
+          scenarios.push_back({ backend, pipeline, birds, flocks });
+        }
+      }
+    }
+  }
+
+  vector<Result> results;
+  for (const Scenario& scenario : scenarios) {
+    Result result;
+    result.scenario = scenario;
+
+    // The same birds for every backend
+    srand(1);
+    SimulationState state(scenario.birds, scenario.flocks);
+    state.CreateFlocks();
+    result.simulated_birds = state.num_of_birds;
+
+    OpenCLBackend opencl_backend;
+    NativeBackend native_backend;
+    SimulationBackend* backend = nullptr;
+    if (scenario.backend == "opencl") {
+      opencl_backend.devices = devices;
+      opencl_backend.requested_device = requested_device;
+      opencl_backend.profile_commands = profile_commands;
+      opencl_backend.program_cache = &program_cache;
+      opencl_backend.two_device_pipeline = scenario.pipeline == "two-device";
+      backend = &opencl_backend;
+    }
+    else if (scenario.backend == "native") {
+      native_backend.simd_level = DetectSimdLevel();
+      backend = &native_backend;
+    }
+    else if (scenario.backend.compare(0, 7, "native-") == 0 && ParseSimdLevel(scenario.backend.substr(7).c_str(), native_backend.simd_level)) {
+      backend = &native_backend;
+    }
+
+    if (backend == nullptr) {
+      result.status = "unknown backend";
+    }
+    else if (!backend->Init(state)) {
+      result.status = "init failed";
+      backend->Shutdown();
+    }
+    else if (scenario.pipeline == "two-device" && !backend->SeparateFlockAverages()) {
+      result.status = "no second device";
+      backend->Shutdown();
+    }
+    else if (scenario.pipeline != "single" && scenario.pipeline != "two-device") {
+      result.status = "unknown pipeline";
+      backend->Shutdown();
+    }
+    else {
+      result.backend_name = backend->Name();
+      vector<double> tick_times;
+      vector<double> averages_times;
+      double simulated_time = 0;
+      for (int tick = 0; tick < warmup + reps; ++tick) {
+        bool timed = tick >= warmup;
+        backend->stage_timings = timed ? &result.stages : nullptr;
+        if (backend->SeparateFlockAverages()) {
+          clock_type::time_point start = clock_type::now();
+          backend->UpdateFlockAverages();
+          if (timed) {
+            averages_times.push_back(MillisecondsSince(start));
+          }
+        }
+        clock_type::time_point start = clock_type::now();
+        backend->Step(delta_time);
+        simulated_time += delta_time;
+        backend->Fetch(simulated_time, simulated_time);
+        backend->Commit(true);
+        if (timed) {
+          tick_times.push_back(MillisecondsSince(start));
+        }
+      }
+      backend->stage_timings = nullptr;
+      backend->Shutdown();
+      result.tick = Summarize(tick_times);
+      result.has_flock_averages = !averages_times.empty();
+      result.flock_averages = Summarize(averages_times);
+    }
+
+    cout << scenario.backend << " " << scenario.pipeline << " " << result.simulated_birds << " birds " << scenario.flocks << " flocks: ";
+    if (result.status == "ok") {
+      cout << result.backend_name << " tick median " << result.tick.median << " ms p99 " << result.tick.p99 << " ms";
+      if (result.has_flock_averages) {
+        cout << ", flock averages median " << result.flock_averages.median << " ms p99 " << result.flock_averages.p99 << " ms";
+      }
+    }
+    else {
+      cout << result.status;
+    }
+    cout << endl;
+    results.push_back(result);
+  }
+
+  if (!json_path.empty()) {
+    std::ofstream json(json_path);
+    WriteJson(json, results, warmup, reps);
+  }
+  if (!csv_path.empty()) {
+    std::ofstream csv(csv_path);
+    WriteCsv(csv, results);
+  }
+  return 0;
+}
@@ -0,0 +1,85 @@
+#include "bird_render_slots.h"
+
+bool BirdRenderSlots::PersistentMappingSupported() {
+  return GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage;
+}
+
+void BirdRenderSlots::Init(GLuint triangle_vbo, GLuint flock_vbo, SimulationState& state, bool persistent_mapping) {
+  // Mapped for the slots' whole lifetime, coherent so nothing has to be flushed before drawing
+  const GLbitfield mapping_flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+  buffer_size = sizeof(vec4) * state.num_of_birds;
+  vec4* initial_data[buffers_per_slot] = { state.bird_pos, state.bird_dir, state.bird_pos, state.bird_dir };
+
+  for (int slot_index = 0; slot_index < num_of_slots; ++slot_index) {
+    Slot& slot = slots[slot_index];
+    glGenVertexArrays(1, &vaos[slot_index]);
+    glBindVertexArray(vaos[slot_index]);
+    glBindBuffer(GL_ARRAY_BUFFER, triangle_vbo);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+    glEnableVertexAttribArray(0);
+
+    glGenBuffers(buffers_per_slot, slot.buffers);
+    for (int i = 0; i < buffers_per_slot; ++i) {
+      glBindBuffer(GL_ARRAY_BUFFER, slot.buffers[i]);
+      if (persistent_mapping) {
+        glBufferStorage(GL_ARRAY_BUFFER, buffer_size, initial_data[i], mapping_flags);
+        slot.mapped[i] = glMapBufferRange(GL_ARRAY_BUFFER, 0, buffer_size, mapping_flags);
+      }
+      else {
+        glBufferData(GL_ARRAY_BUFFER, buffer_size, initial_data[i], GL_DYNAMIC_DRAW);
+      }
+      glVertexAttribPointer(i + 1, 4, GL_FLOAT, GL_FALSE, 0, (void*)0);
+      glEnableVertexAttribArray(i + 1);
+      glVertexAttribDivisor(i + 1, 1);
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, flock_vbo);
+    glVertexAttribIPointer(5, 1, GL_UNSIGNED_INT, 0, (void*)0);
+    glEnableVertexAttribArray(5);
+    glVertexAttribDivisor(5, 1);
+  }
+  glBindVertexArray(0);
+  // The simulation fills the slots from another thread or API, make sure the initial data is there first
+  glFinish();
+}
+
+bool BirdRenderSlots::AcquireNewest() {
+  if (!handoff.HasNew()) {
+    return false;
+  }
+  // The slot drawn so far goes back to the simulation, wait until the GPU is done drawing it.
+  // The fence is from an earlier frame, so it has almost always signalled already.
+  GLsync& previous_fence = draw_fences[handoff.read_slot];
+  if (previous_fence != 0) {
+    glClientWaitSync(previous_fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+    glDeleteSync(previous_fence);
+    previous_fence = 0;
+  }
+  return handoff.Acquire();
+}
+
+void BirdRenderSlots::FenceDraw() {
+  GLsync& fence = draw_fences[handoff.read_slot];
+  if (fence != 0) {
+    glDeleteSync(fence);
+  }
+  fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+void BirdRenderSlots::Release() {
+  for (int slot_index = 0; slot_index < num_of_slots; ++slot_index) {
+    Slot& slot = slots[slot_index];
+    if (draw_fences[slot_index] != 0) {
+      glDeleteSync(draw_fences[slot_index]);
+    }
+    for (int i = 0; i < buffers_per_slot; ++i) {
+      if (slot.mapped[i] != NULL) {
+        glBindBuffer(GL_ARRAY_BUFFER, slot.buffers[i]);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+      }
+    }
+    glDeleteBuffers(buffers_per_slot, slot.buffers);
+    glDeleteVertexArrays(1, &vaos[slot_index]);
+  }
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include "shader.h"
+#include "simulation_state.h"
+#include "bird_render_targets.h"
+
+// Bird instance buffers the renderer draws from, filled by the simulation thread either on the device
+// (OpenCL-OpenGL sharing) or through persistently mapped pointers the birds are read back into.
+// There are three sets of them handed over through TripleBufferSlots, so the simulation can fill one
+// while the renderer draws another. A slot is only handed back to the simulation once the draws
+// using it have completed, see AcquireNewest. The backends only get the BirdRenderTargets base.
+struct BirdRenderSlots : BirdRenderTargets {
+  // Render thread objects of each slot
+  GLuint vaos[num_of_slots]{};
+  GLsync draw_fences[num_of_slots]{};
+  size_t buffer_size = 0;
+
+  // Render thread
+  static bool PersistentMappingSupported();
+  void Init(GLuint triangle_vbo, GLuint flock_vbo, SimulationState& state, bool persistent_mapping);
+  bool AcquireNewest();
+  Slot& ReadSlot() { return slots[handoff.read_slot]; }
+  GLuint ReadVertexArray() const { return vaos[handoff.read_slot]; }
+  void FenceDraw();
+  void Release();
+};
@@ -0,0 +1,32 @@
+#pragma once
+#include <CL/cl_platform.h>
+#include "tick_scheduler.h"
+#include "triple_buffer.h"
+
+// The simulation thread's side of BirdRenderSlots: the vertex buffers each tick's birds are written into and their
+// handoff to the renderer, without OpenGL. The backends only see these, so they (and the benchmark linking them)
+// don't depend on the OpenGL libraries. BirdRenderSlots creates the buffers and fills in their names and mapped
+// pointers on the render thread.
+struct BirdRenderTargets {
+  static const int num_of_slots = 3;
+  static const int buffers_per_slot = 4; // pos, dir, prev pos, prev dir, instance attributes 1 to 4 of bird_v.glsl
+
+  struct Slot {
+    cl_GLuint buffers[buffers_per_slot]{}; // OpenGL buffer names, for clCreateFromGLBuffer
+    void* mapped[buffers_per_slot]{}; // coherent write pointers into the buffers, persistent mapping only
+    // Simulated seconds of the pos/dir and prev pos/dir buffers, written by the producer before publishing
+    double simulated_time = 0;
+    double prev_simulated_time = 0;
+    TickScheduler::clock::time_point publish_clock_time;
+  };
+
+  Slot slots[num_of_slots];
+  TripleBufferSlots handoff;
+
+  // Simulation thread
+  Slot& WriteSlot() { return slots[handoff.write_slot]; }
+  void Publish() {
+    WriteSlot().publish_clock_time = TickScheduler::clock::now();
+    handoff.Publish();
+  }
+};
@@ -0,0 +1,19 @@
+#include "bird_snapshots.h"
+#include <cstring>
+
+void BirdSnapshots::Init(const SimulationState& state) {
+  size_t bird_vectors_size = sizeof(vec4) * state.num_of_birds;
+  for (Snapshot& snapshot : snapshots) {
+    AlignedArray<vec4>* arrays[4] = { &snapshot.pos, &snapshot.dir, &snapshot.prev_pos, &snapshot.prev_dir };
+    const vec4* initial_data[4] = { state.bird_pos, state.bird_dir, state.bird_pos, state.bird_dir };
+    for (int i = 0; i < 4; ++i) {
+      arrays[i]->Allocate(state.num_of_birds);
+      std::memcpy(arrays[i]->data, initial_data[i], bird_vectors_size);
+    }
+  }
+}
+
+void BirdSnapshots::Publish() {
+  WriteSnapshot().publish_clock_time = TickScheduler::clock::now();
+  handoff.Publish();
+}
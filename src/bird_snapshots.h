@@ -0,0 +1,37 @@
+#pragma once
+#include "simulation_state.h"
+#include "tick_scheduler.h"
+#include "triple_buffer.h"
+
+// Complete ticks handed from the simulation thread to the renderer in host memory, when the birds can't go through
+// BirdRenderSlots. The simulation fills the write snapshot and publishes it once the whole tick is in, the renderer
+// draws the newest published snapshot. The three snapshots are handed over through TripleBufferSlots, so neither
+// side waits for the other and the renderer never reads a tick that is still being written.
+struct BirdSnapshots {
+  static const int num_of_snapshots = 3;
+
+  struct Snapshot {
+    AlignedArray<vec4> pos;
+    AlignedArray<vec4> dir;
+    // The step before pos/dir, only written when prev_simulated_time is earlier than simulated_time
+    AlignedArray<vec4> prev_pos;
+    AlignedArray<vec4> prev_dir;
+    double simulated_time = 0;
+    double prev_simulated_time = 0;
+    TickScheduler::clock::time_point publish_clock_time;
+  };
+
+  Snapshot snapshots[num_of_snapshots];
+  TripleBufferSlots handoff;
+
+  // Every snapshot starts out as the state's birds, so there is something to draw before the first publish
+  void Init(const SimulationState& state);
+
+  // Render thread
+  bool AcquireNewest() { return handoff.Acquire(); }
+  const Snapshot& ReadSnapshot() const { return snapshots[handoff.read_slot]; }
+
+  // Simulation thread
+  Snapshot& WriteSnapshot() { return snapshots[handoff.write_slot]; }
+  void Publish();
+};
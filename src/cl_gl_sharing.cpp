@@ -0,0 +1,23 @@
+#include "cl_gl_sharing.h"
+#include <GLFW/glfw3.h>
+#if defined(_WIN32)
+#define GLFW_EXPOSE_NATIVE_WIN32
+#define GLFW_EXPOSE_NATIVE_WGL
+#elif defined(__linux__)
+#define GLFW_EXPOSE_NATIVE_X11
+#define GLFW_EXPOSE_NATIVE_GLX
+#endif
+#include <GLFW/glfw3native.h>
+#include <CL/cl_gl.h>
+
+bool GLSharingContextProperties(GLFWwindow* window, std::vector<cl_context_properties>& properties) {
+#if defined(_WIN32)
+  properties = { CL_GL_CONTEXT_KHR, (cl_context_properties)glfwGetWGLContext(window), CL_WGL_HDC_KHR, (cl_context_properties)GetDC(glfwGetWin32Window(window)) };
+  return true;
+#elif defined(__linux__)
+  properties = { CL_GL_CONTEXT_KHR, (cl_context_properties)glfwGetGLXContext(window), CL_GLX_DISPLAY_KHR, (cl_context_properties)glfwGetX11Display() };
+  return true;
+#else
+  return false;
+#endif
+}
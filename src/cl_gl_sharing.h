@@ -0,0 +1,11 @@
+#pragma once
+#include <CL/opencl.h>
+#include <vector>
+
+struct GLFWwindow;
+
+// Context properties identifying the window's OpenGL context to an OpenCL context created with it
+// (cl_khr_gl_sharing): CL_GL_CONTEXT_KHR and the WGL device context or GLX display, without
+// CL_CONTEXT_PLATFORM or the terminating 0. Kept in its own file, it is the only code that needs
+// GLFW's native headers (Win32/WGL, X11/GLX). Returns false on platforms without a sharing path.
+bool GLSharingContextProperties(GLFWwindow* window, std::vector<cl_context_properties>& properties);
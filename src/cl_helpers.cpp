@@ -0,0 +1,58 @@
+#include "cl_helpers.h"
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <sstream>
+
+size_t PowerOfTwoWorkGroupSize(cl_kernel kernel, cl_device_id device, size_t limit) {
+  size_t max_work_group_size = 1;
+  clGetKernelWorkGroupInfo(kernel, device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &max_work_group_size, NULL);
+  size_t size = 1;
+  while (size * 2 <= std::min(max_work_group_size, limit)) {
+    size *= 2;
+  }
+  return size;
+}
+
+size_t RoundUpWorkSize(size_t work_size, size_t local_size) {
+  return (work_size + local_size - 1) / local_size * local_size;
+}
+
+std::string DeviceInfoString(cl_device_id device, cl_device_info info) {
+  size_t size = 0;
+  clGetDeviceInfo(device, info, 0, NULL, &size);
+  std::string value(size, '\0');
+  clGetDeviceInfo(device, info, size, &value[0], NULL);
+  // Drop the null terminator
+  return value.c_str();
+}
+
+std::string ProgramBuildLog(cl_program program, cl_device_id device) {
+  size_t size = 0;
+  clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, 0, NULL, &size);
+  std::string log(size, '\0');
+  clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, size, &log[0], NULL);
+  log = log.c_str();
+  // Some compilers log only whitespace on success
+  return log.find_first_not_of(" \t\r\n") == std::string::npos ? std::string() : log;
+}
+
+bool DeviceHasExtension(cl_device_id device, const char* extension) {
+  // Extensions are separated by spaces, compare whole names so prefixes of other extensions don't match
+  std::istringstream names(DeviceInfoString(device, CL_DEVICE_EXTENSIONS));
+  std::string name;
+  while (names >> name) {
+    if (name == extension) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool CheckCL(cl_int err, const char* operation) {
+  if (err != CL_SUCCESS) {
+    std::cerr << "OpenCL error " << err << " in " << operation << std::endl;
+    return false;
+  }
+  return true;
+}
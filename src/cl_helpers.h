@@ -0,0 +1,21 @@
+#pragma once
+#include <CL/opencl.h>
+#include <string>
+
+// Largest power of two work group size the device allows for the kernel, capped at limit
+size_t PowerOfTwoWorkGroupSize(cl_kernel kernel, cl_device_id device, size_t limit);
+
+// Rounds a global work size up to a multiple of the work group size
+size_t RoundUpWorkSize(size_t work_size, size_t local_size);
+
+// String valued device info such as CL_DEVICE_NAME or CL_DRIVER_VERSION
+std::string DeviceInfoString(cl_device_id device, cl_device_info info);
+
+// Build log of the program for the device, empty if the compiler had nothing to say
+std::string ProgramBuildLog(cl_program program, cl_device_id device);
+
+// True if the device lists the extension in CL_DEVICE_EXTENSIONS
+bool DeviceHasExtension(cl_device_id device, const char* extension);
+
+// Writes the error to std::cerr and returns false unless err is CL_SUCCESS
+bool CheckCL(cl_int err, const char* operation);
@@ -0,0 +1,143 @@
+#include "command_profiler.h"
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+
+namespace {
+
+void AddToPhase(CommandProfiler::Phase& phase, cl_ulong from, cl_ulong to) {
+  double us = to > from ? (to - from) / 1000.0 : 0.0;
+  phase.total += us;
+  phase.max = std::max(phase.max, us);
+  int bucket = us < 2 ? 0 : std::min((int)std::log2(us), CommandProfiler::num_of_buckets - 1);
+  phase.histogram[bucket] += 1;
+}
+
+void PrintHistogram(std::ostream& out, const char* label, const CommandProfiler::Phase& phase) {
+  out << "    " << label << " us:";
+  for (int bucket = 0; bucket < CommandProfiler::num_of_buckets; ++bucket) {
+    if (phase.histogram[bucket] > 0) {
+      if (bucket == 0) {
+        out << " <2 ";
+      }
+      else {
+        out << " " << (1 << bucket) << "+ ";
+      }
+      out << phase.histogram[bucket];
+    }
+  }
+  out << std::endl;
+}
+
+}
+
+cl_event* CommandProfiler::Event(const char* name) {
+  if (!enabled) {
+    return NULL;
+  }
+  pending.push_back(Pending());
+  pending.back().name = name;
+  return &pending.back().event;
+}
+
+void CommandProfiler::Track(const char* name, cl_event event) {
+  if (!enabled || event == NULL) {
+    return;
+  }
+  clRetainEvent(event);
+  pending.push_back(Pending());
+  pending.back().name = name;
+  pending.back().event = event;
+}
+
+void CommandProfiler::Add(const char* name, cl_event event) {
+  cl_ulong queued = 0, submit = 0, start = 0, end = 0;
+  if (clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_QUEUED, sizeof(cl_ulong), &queued, NULL) != CL_SUCCESS ||
+    clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_SUBMIT, sizeof(cl_ulong), &submit, NULL) != CL_SUCCESS ||
+    clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &start, NULL) != CL_SUCCESS ||
+    clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &end, NULL) != CL_SUCCESS) {
+    // The queue wasn't created with CL_QUEUE_PROFILING_ENABLE
+    return;
+  }
+  auto command = std::find_if(commands.begin(), commands.end(), [&](const Command& c) { return c.name == name; });
+  if (command == commands.end()) {
+    commands.push_back(Command());
+    command = commands.end() - 1;
+    command->name = name;
+  }
+  command->count += 1;
+  AddToPhase(command->queued, queued, submit);
+  AddToPhase(command->submitted, submit, start);
+  AddToPhase(command->running, start, end);
+}
+
+void CommandProfiler::AddCompleted() {
+  for (auto it = pending.begin(); it != pending.end();) {
+    cl_int status = CL_COMPLETE;
+    // A NULL event means the command failed to enqueue
+    if (it->event != NULL) {
+      clGetEventInfo(it->event, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(cl_int), &status, NULL);
+      if (status == CL_COMPLETE) {
+        Add(it->name, it->event);
+      }
+    }
+    // Negative statuses are errors, the command will never complete
+    if (status == CL_COMPLETE || status < 0) {
+      if (it->event != NULL) {
+        clReleaseEvent(it->event);
+      }
+      it = pending.erase(it);
+    }
+    else {
+      ++it;
+    }
+  }
+}
+
+void CommandProfiler::Collect() {
+  if (!enabled) {
+    return;
+  }
+  AddCompleted();
+  if (report_interval > 0 && std::chrono::duration<double>(clock::now() - report_start).count() >= report_interval) {
+    Report(std::cout);
+  }
+}
+
+void CommandProfiler::Report(std::ostream& out) {
+  for (const Pending& command : pending) {
+    if (command.event != NULL) {
+      clWaitForEvents(1, &command.event);
+    }
+  }
+  double seconds = std::chrono::duration<double>(clock::now() - report_start).count();
+  AddCompleted();
+  if (!commands.empty()) {
+    Print(out, seconds);
+  }
+  commands.clear();
+  report_start = clock::now();
+}
+
+void CommandProfiler::Print(std::ostream& out, double seconds) const {
+  size_t name_width = 7;
+  double total_running = 0;
+  for (const Command& command : commands) {
+    name_width = std::max(name_width, command.name.size());
+    total_running += command.running.total;
+  }
+  out << "OpenCL commands on the " << queue_name << " queue over " << std::fixed << std::setprecision(1) << seconds << " s" << std::endl;
+  out << std::left << std::setw(name_width) << "command" << std::right << std::setw(8) << "count" << std::setw(12) << "queued us"
+    << std::setw(12) << "submit us" << std::setw(12) << "run us" << std::setw(12) << "max run us" << std::setw(8) << "share" << std::endl;
+  for (const Command& command : commands) {
+    out << std::left << std::setw(name_width) << command.name << std::right << std::setw(8) << command.count
+      << std::setw(12) << command.queued.total / command.count << std::setw(12) << command.submitted.total / command.count
+      << std::setw(12) << command.running.total / command.count << std::setw(12) << command.running.max
+      << std::setw(7) << (total_running > 0 ? command.running.total / total_running * 100 : 0) << "%" << std::endl;
+    PrintHistogram(out, "queued", command.queued);
+    PrintHistogram(out, "submit", command.submitted);
+    PrintHistogram(out, "run", command.running);
+  }
+  out << std::defaultfloat;
+}
@@ -0,0 +1,69 @@
+#pragma once
+#include <CL/opencl.h>
+#include <chrono>
+#include <list>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Device side durations of the commands enqueued on one command queue, read from their events once they complete.
+// The queue must be created with CL_QUEUE_PROFILING_ENABLE. Each command is split into the time it waited to be
+// submitted (queued to submit), to start running (submit to start) and the time it ran (start to end), and every
+// phase is kept as a histogram of power of two microsecond buckets per command name. Not thread safe, a queue's
+// commands are enqueued and collected by one thread.
+struct CommandProfiler {
+  using clock = std::chrono::steady_clock;
+
+  // Bucket 0 counts durations under 2 us, bucket b >= 1 durations from 2^b us up to 2^(b+1) us, the last one has no upper bound
+  static const int num_of_buckets = 16;
+
+  struct Phase {
+    double total = 0; // in microseconds
+    double max = 0;
+    long long histogram[num_of_buckets]{};
+  };
+
+  struct Command {
+    std::string name;
+    long long count = 0;
+    Phase queued; // queued to submit
+    Phase submitted; // submit to start
+    Phase running; // start to end
+  };
+
+  // Off unless set before the first command, Event then returns NULL and nothing is tracked
+  bool enabled = false;
+  // Printed in the report header
+  std::string queue_name;
+  // Collect prints and restarts the histograms this often, 0 to only print them from Report
+  double report_interval = 5;
+
+  std::vector<Command> commands;
+
+  // Event to pass to a command named name, tracked until it completes. NULL when profiling is off, so the
+  // command gets no event.
+  cl_event* Event(const char* name);
+  // Tracks a command whose event the caller keeps, retaining it
+  void Track(const char* name, cl_event event);
+  // Adds the completed commands to the histograms, and prints them every report_interval seconds
+  void Collect();
+  // Waits for the commands still tracked, then prints and restarts the histograms
+  void Report(std::ostream& out);
+  // One line per command with the count, mean of each phase and share of the queue's running time,
+  // followed by the non empty buckets of each phase
+  void Print(std::ostream& out, double seconds) const;
+
+private:
+  struct Pending {
+    const char* name;
+    cl_event event = NULL;
+  };
+
+  void Add(const char* name, cl_event event);
+  // Adds the completed commands and stops tracking them, along with the ones that failed
+  void AddCompleted();
+
+  // A list, Event hands out pointers into it that stay valid while later commands are added
+  std::list<Pending> pending;
+  clock::time_point report_start = clock::now();
+};
@@ -0,0 +1,233 @@
+#include "device_selection.h"
+#include "cl_helpers.h"
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+
+namespace {
+
+// Every work item sums over all positions in tiles loaded into local memory, like simulate_bird_tiled
+const char* benchmark_source =
+"__kernel void benchmark_pairs(__global const float4* pos, __global float4* out, __local float4* tile) {\n"
+"  size_t gid = get_global_id(0);\n"
+"  size_t lid = get_local_id(0);\n"
+"  size_t local_size = get_local_size(0);\n"
+"  size_t n = get_global_size(0);\n"
+"  float4 p = pos[gid];\n"
+"  float4 sum = (float4)(0.0f);\n"
+"  for (size_t start = 0; start < n; start += local_size) {\n"
+"    tile[lid] = pos[start + lid];\n"
+"    barrier(CLK_LOCAL_MEM_FENCE);\n"
+"    for (size_t j = 0; j < local_size; ++j) {\n"
+"      float4 delta = tile[j] - p;\n"
+"      delta.w = 0.0f;\n"
+"      sum += delta * native_rsqrt(dot(delta, delta) + 0.01f);\n"
+"    }\n"
+"    barrier(CLK_LOCAL_MEM_FENCE);\n"
+"  }\n"
+"  out[gid] = sum;\n"
+"}\n";
+
+const size_t benchmark_items = 4096;
+const int benchmark_runs = 3;
+
+// Best of benchmark_runs timed runs after a warm up run, in millions of pairs per second. 0 on any error.
+double RunBenchmark(const DeviceCandidate& candidate) {
+  cl_int err;
+  double mpairs = 0;
+  cl_context context = clCreateContext(NULL, 1, &candidate.device, NULL, NULL, &err);
+  if (!CheckCL(err, "clCreateContext (benchmark)")) {
+    return 0;
+  }
+  cl_command_queue queue = clCreateCommandQueue(context, candidate.device, 0, &err);
+  cl_program program = clCreateProgramWithSource(context, 1, &benchmark_source, NULL, &err);
+  cl_kernel kernel = NULL;
+  cl_mem pos_buffer = NULL, out_buffer = NULL;
+  if (CheckCL(err, "clCreateProgramWithSource (benchmark)") && CheckCL(clBuildProgram(program, 1, &candidate.device, NULL, NULL, NULL), "clBuildProgram (benchmark)")) {
+    kernel = clCreateKernel(program, "benchmark_pairs", &err);
+  }
+  if (kernel != NULL) {
+    std::vector<cl_float4> positions(benchmark_items);
+    for (size_t i = 0; i < benchmark_items; ++i) {
+      positions[i] = { { (float)(i % 16), (float)(i / 16 % 16), (float)(i / 256), 0.0f } };
+    }
+    pos_buffer = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(cl_float4) * benchmark_items, positions.data(), &err);
+    out_buffer = clCreateBuffer(context, CL_MEM_WRITE_ONLY, sizeof(cl_float4) * benchmark_items, NULL, &err);
+    size_t local_size = PowerOfTwoWorkGroupSize(kernel, candidate.device, 64);
+    size_t work_dims[1]{ benchmark_items };
+    size_t local_dims[1]{ local_size };
+    clSetKernelArg(kernel, 0, sizeof(cl_mem), (void*)&pos_buffer);
+    clSetKernelArg(kernel, 1, sizeof(cl_mem), (void*)&out_buffer);
+    clSetKernelArg(kernel, 2, sizeof(cl_float4) * local_size, NULL);
+    double best_seconds = 0;
+    for (int run = 0; run <= benchmark_runs; ++run) {
+      auto start = std::chrono::steady_clock::now();
+      err = clEnqueueNDRangeKernel(queue, kernel, 1, NULL, work_dims, local_dims, 0, NULL, NULL);
+      if (!CheckCL(err, "clEnqueueNDRangeKernel (benchmark)") || !CheckCL(clFinish(queue), "clFinish (benchmark)")) {
+        best_seconds = 0;
+        break;
+      }
+      double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      // Run 0 warms up
+      if (run == 1 || (run > 1 && seconds < best_seconds)) {
+        best_seconds = seconds;
+      }
+    }
+    if (best_seconds > 0) {
+      mpairs = (double)benchmark_items * benchmark_items / best_seconds / 1e6;
+    }
+  }
+  if (out_buffer != NULL) {
+    clReleaseMemObject(out_buffer);
+  }
+  if (pos_buffer != NULL) {
+    clReleaseMemObject(pos_buffer);
+  }
+  if (kernel != NULL) {
+    clReleaseKernel(kernel);
+  }
+  if (program != NULL) {
+    clReleaseProgram(program);
+  }
+  if (queue != NULL) {
+    clReleaseCommandQueue(queue);
+  }
+  clReleaseContext(context);
+  return mpairs;
+}
+
+template<typename T>
+T DeviceInfo(cl_device_id device, cl_device_info info) {
+  T value{};
+  clGetDeviceInfo(device, info, sizeof(T), &value, NULL);
+  return value;
+}
+
+}
+
+std::vector<DeviceCandidate> FindDevices(bool benchmark) {
+  std::vector<DeviceCandidate> candidates;
+  cl_uint num_platforms = 0;
+  // No ICD loader or no platform at all
+  if (clGetPlatformIDs(0, NULL, &num_platforms) != CL_SUCCESS || num_platforms == 0) {
+    return candidates;
+  }
+  std::vector<cl_platform_id> platform_ids(num_platforms);
+  if (!CheckCL(clGetPlatformIDs(num_platforms, platform_ids.data(), NULL), "clGetPlatformIDs")) {
+    return candidates;
+  }
+
+  for (cl_platform_id platform : platform_ids) {
+    cl_uint num_devices = 0;
+    // CL_DEVICE_NOT_FOUND is fine, the platform just has no devices
+    if (clGetDeviceIDs(platform, CL_DEVICE_TYPE_ALL, 0, NULL, &num_devices) != CL_SUCCESS || num_devices == 0) {
+      continue;
+    }
+    std::vector<cl_device_id> device_ids(num_devices);
+    if (!CheckCL(clGetDeviceIDs(platform, CL_DEVICE_TYPE_ALL, num_devices, device_ids.data(), NULL), "clGetDeviceIDs")) {
+      continue;
+    }
+    size_t platform_name_size = 0;
+    clGetPlatformInfo(platform, CL_PLATFORM_NAME, 0, NULL, &platform_name_size);
+    std::string platform_name(platform_name_size, '\0');
+    clGetPlatformInfo(platform, CL_PLATFORM_NAME, platform_name_size, &platform_name[0], NULL);
+
+    for (cl_device_id device : device_ids) {
+      DeviceCandidate candidate;
+      candidate.platform = platform;
+      candidate.device = device;
+      candidate.platform_name = platform_name.c_str();
+      candidate.name = DeviceInfoString(device, CL_DEVICE_NAME);
+      candidate.type = DeviceInfo<cl_device_type>(device, CL_DEVICE_TYPE);
+      candidate.compute_units = DeviceInfo<cl_uint>(device, CL_DEVICE_MAX_COMPUTE_UNITS);
+      candidate.clock_mhz = DeviceInfo<cl_uint>(device, CL_DEVICE_MAX_CLOCK_FREQUENCY);
+      candidate.local_mem_size = DeviceInfo<cl_ulong>(device, CL_DEVICE_LOCAL_MEM_SIZE);
+      candidate.dedicated_local_mem = DeviceInfo<cl_device_local_mem_type>(device, CL_DEVICE_LOCAL_MEM_TYPE) == CL_LOCAL;
+      candidate.estimate = (double)candidate.compute_units * candidate.clock_mhz * (candidate.dedicated_local_mem ? 1.0 : 0.5);
+
+      if (!DeviceInfo<cl_bool>(device, CL_DEVICE_AVAILABLE)) {
+        candidate.unusable_reason = "not available";
+      }
+      else if (!DeviceInfo<cl_bool>(device, CL_DEVICE_COMPILER_AVAILABLE)) {
+        candidate.unusable_reason = "no compiler";
+      }
+      else if (candidate.local_mem_size < min_local_mem_size) {
+        candidate.unusable_reason = "not enough local memory";
+      }
+      candidate.usable = candidate.unusable_reason.empty();
+
+      if (candidate.usable && benchmark) {
+        candidate.benchmark_mpairs = RunBenchmark(candidate);
+        if (candidate.benchmark_mpairs <= 0) {
+          candidate.usable = false;
+          candidate.unusable_reason = "benchmark failed";
+        }
+      }
+      candidate.score = !candidate.usable ? 0 : benchmark ? candidate.benchmark_mpairs : candidate.estimate;
+      candidates.push_back(candidate);
+    }
+  }
+  return candidates;
+}
+
+DeviceAssignment AssignDevices(const std::vector<DeviceCandidate>& candidates, int requested_device, bool two_devices) {
+  DeviceAssignment assignment;
+  auto better = [&](int candidate, int best) {
+    return candidates[candidate].usable && (best < 0 || candidates[candidate].score > candidates[best].score);
+  };
+
+  if (requested_device >= 0 && requested_device < (int)candidates.size() && candidates[requested_device].usable) {
+    assignment.simulation = requested_device;
+  }
+  else {
+    if (requested_device >= 0) {
+      std::cerr << "OpenCL device " << requested_device << " is not usable, picking the best scoring device" << std::endl;
+    }
+    for (int i = 0; i < (int)candidates.size(); ++i) {
+      if (better(i, assignment.simulation)) {
+        assignment.simulation = i;
+      }
+    }
+  }
+
+  if (two_devices && assignment.simulation >= 0) {
+    int best_cpu = -1;
+    int best_other = -1;
+    for (int i = 0; i < (int)candidates.size(); ++i) {
+      if (i == assignment.simulation) {
+        continue;
+      }
+      if ((candidates[i].type & CL_DEVICE_TYPE_CPU) && better(i, best_cpu)) {
+        best_cpu = i;
+      }
+      if (better(i, best_other)) {
+        best_other = i;
+      }
+    }
+    assignment.flock_averages = best_cpu >= 0 ? best_cpu : best_other;
+  }
+  return assignment;
+}
+
+void PrintDevices(const std::vector<DeviceCandidate>& candidates, const DeviceAssignment& assignment) {
+  for (int i = 0; i < (int)candidates.size(); ++i) {
+    const DeviceCandidate& candidate = candidates[i];
+    std::cout << "OpenCL device " << i << ": " << candidate.name << " (" << candidate.platform_name << ")"
+      << " " << candidate.compute_units << " CU @ " << candidate.clock_mhz << " MHz, " << candidate.local_mem_size / 1024 << " KB "
+      << (candidate.dedicated_local_mem ? "local" : "emulated local") << " memory";
+    if (candidate.benchmark_mpairs > 0) {
+      std::cout << ", " << std::fixed << std::setprecision(0) << candidate.benchmark_mpairs << " Mpairs/s" << std::defaultfloat;
+    }
+    if (!candidate.usable) {
+      std::cout << ", unusable: " << candidate.unusable_reason;
+    }
+    if (i == assignment.simulation) {
+      std::cout << " [simulation]";
+    }
+    if (i == assignment.flock_averages) {
+      std::cout << " [flock averages]";
+    }
+    std::cout << std::endl;
+  }
+}
@@ -0,0 +1,47 @@
+#pragma once
+#include <CL/opencl.h>
+#include <string>
+#include <vector>
+
+// An OpenCL device found on any platform, with what it was scored on
+struct DeviceCandidate {
+  cl_platform_id platform = NULL;
+  cl_device_id device = NULL;
+  cl_device_type type = 0;
+  std::string name;
+  std::string platform_name;
+  cl_uint compute_units = 0;
+  cl_uint clock_mhz = 0;
+  cl_ulong local_mem_size = 0;
+  bool dedicated_local_mem = false; // CL_LOCAL, emulated in global memory otherwise (most CPU devices)
+  bool usable = false; // available, has a compiler and enough local memory for the kernels
+  std::string unusable_reason;
+  // Compute units * clock, halved without dedicated local memory, the score when not benchmarking
+  double estimate = 0;
+  // Millions of pair interactions per second in the micro-benchmark, 0 if it wasn't run or failed
+  double benchmark_mpairs = 0;
+  double score = 0;
+};
+
+// Devices the simulation and the flock averages run on, indices into the candidates, -1 for none
+struct DeviceAssignment {
+  int simulation = -1;
+  int flock_averages = -1;
+};
+
+// Local memory the tiled simulation kernel and the flock averages reduction need at their work group sizes
+const cl_ulong min_local_mem_size = 16 * 1024;
+
+// Every device of every platform. Platforms or devices that fail to report are skipped.
+// With benchmark set, each usable device runs a short all-pairs micro-benchmark close to the separation
+// kernel's inner loop and is scored by its throughput, otherwise by its estimate. Devices whose
+// benchmark fails are marked unusable.
+std::vector<DeviceCandidate> FindDevices(bool benchmark);
+
+// The simulation goes to requested_device if it is usable, to the best scoring device otherwise.
+// With two_devices, the flock averages go to the best CPU device other than the simulation's, or the best
+// other device if there is no CPU device; without a second device they stay on the simulation device.
+DeviceAssignment AssignDevices(const std::vector<DeviceCandidate>& candidates, int requested_device, bool two_devices);
+
+// One line per device with its index, scores and assignment
+void PrintDevices(const std::vector<DeviceCandidate>& candidates, const DeviceAssignment& assignment);
@@ -0,0 +1,68 @@
+#include "flock_averages.h"
+#include "cl_helpers.h"
+#include <algorithm>
+
+bool FlockAverages::Init(cl_context context, cl_device_id device, cl_program program, SimulationState& state, cl_mem flock_ranges_buffer, cl_mem flock_avgs_buffer) {
+  cl_int err;
+
+  sum_kernel = clCreateKernel(program, "sum_flock_blocks", &err);
+  if (!CheckCL(err, "clCreateKernel (sum_flock_blocks)")) {
+    return false;
+  }
+  combine_kernel = clCreateKernel(program, "combine_flock_sums", &err);
+  if (!CheckCL(err, "clCreateKernel (combine_flock_sums)")) {
+    return false;
+  }
+
+  sum_local_size = PowerOfTwoWorkGroupSize(sum_kernel, device, 256);
+  combine_local_size = PowerOfTwoWorkGroupSize(combine_kernel, device, 64);
+
+  // Enough blocks that every work item of the largest flock sums about reduction_birds_per_work_item birds
+  size_t birds_per_block = sum_local_size * SimulationState::reduction_birds_per_work_item;
+  blocks_per_flock = (cl_uint)std::max<size_t>(1, (state.LargestFlockSize() + birds_per_block - 1) / birds_per_block);
+  sum_work_dims[0] = state.num_of_flocks * blocks_per_flock * sum_local_size;
+  combine_work_dims[0] = state.num_of_flocks * combine_local_size;
+
+  partial_sums_buffer = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(cl_float4) * 2 * state.num_of_flocks * blocks_per_flock, NULL, &err);
+  if (!CheckCL(err, "clCreateBuffer (flock partial sums)")) {
+    return false;
+  }
+
+  err = clSetKernelArg(sum_kernel, 2, sizeof(cl_mem), (void*)&flock_ranges_buffer);
+  err = clSetKernelArg(sum_kernel, 3, sizeof(cl_mem), (void*)&partial_sums_buffer);
+  err = clSetKernelArg(sum_kernel, 4, sizeof(cl_uint), (void*)&blocks_per_flock);
+  err = clSetKernelArg(sum_kernel, 5, sizeof(cl_float4) * sum_local_size, NULL);
+  err = clSetKernelArg(sum_kernel, 6, sizeof(cl_float4) * sum_local_size, NULL);
+
+  err = clSetKernelArg(combine_kernel, 0, sizeof(cl_mem), (void*)&partial_sums_buffer);
+  err = clSetKernelArg(combine_kernel, 1, sizeof(cl_mem), (void*)&flock_avgs_buffer);
+  err = clSetKernelArg(combine_kernel, 2, sizeof(cl_mem), (void*)&flock_ranges_buffer);
+  err = clSetKernelArg(combine_kernel, 3, sizeof(cl_uint), (void*)&blocks_per_flock);
+  err = clSetKernelArg(combine_kernel, 4, sizeof(cl_float4) * combine_local_size, NULL);
+  err = clSetKernelArg(combine_kernel, 5, sizeof(cl_float4) * combine_local_size, NULL);
+  return true;
+}
+
+// Enqueues both reduction stages over the birds in pos_buffer and dir_buffer. The averages are in flock_avgs_buffer once the second kernel completes.
+void FlockAverages::Enqueue(cl_command_queue queue, CommandProfiler& profiler, cl_mem pos_buffer, cl_mem dir_buffer) {
+  cl_int err;
+  err = clSetKernelArg(sum_kernel, 0, sizeof(cl_mem), (void*)&pos_buffer);
+  err = clSetKernelArg(sum_kernel, 1, sizeof(cl_mem), (void*)&dir_buffer);
+  size_t sum_local_dims[1]{ sum_local_size };
+  size_t combine_local_dims[1]{ combine_local_size };
+  err = clEnqueueNDRangeKernel(queue, sum_kernel, 1, NULL, sum_work_dims, sum_local_dims, 0, NULL, profiler.Event("kernel: flock averages sum"));
+  err = clEnqueueNDRangeKernel(queue, combine_kernel, 1, NULL, combine_work_dims, combine_local_dims, 0, NULL, profiler.Event("kernel: flock averages combine"));
+}
+
+void FlockAverages::Release() {
+  // Init may have stopped part way, only release what was created
+  if (partial_sums_buffer != NULL) {
+    clReleaseMemObject(partial_sums_buffer);
+  }
+  cl_kernel kernels[] = { sum_kernel, combine_kernel };
+  for (cl_kernel kernel : kernels) {
+    if (kernel != NULL) {
+      clReleaseKernel(kernel);
+    }
+  }
+}
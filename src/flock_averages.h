@@ -0,0 +1,24 @@
+#pragma once
+#include <CL/opencl.h>
+#include "simulation_state.h"
+#include "command_profiler.h"
+
+// Two stage work group reduction of the flock average direction and position, see flock_avgs_kernel in kernels.h.
+// The number of work groups scales with the number of birds rather than the number of flocks.
+struct FlockAverages {
+  cl_uint blocks_per_flock = 1;
+  size_t sum_local_size = 1;
+  size_t combine_local_size = 1;
+  size_t sum_work_dims[1]{};
+  size_t combine_work_dims[1]{};
+
+  cl_kernel sum_kernel = NULL;
+  cl_kernel combine_kernel = NULL;
+
+  cl_mem partial_sums_buffer = NULL;
+
+  // Returns false if a kernel or buffer can't be created, after writing why to std::cerr
+  bool Init(cl_context context, cl_device_id device, cl_program program, SimulationState& state, cl_mem flock_ranges_buffer, cl_mem flock_avgs_buffer);
+  void Enqueue(cl_command_queue queue, CommandProfiler& profiler, cl_mem pos_buffer, cl_mem dir_buffer);
+  void Release();
+};
@@ -0,0 +1,62 @@
+#include "gpu_pass_timer.h"
+
+bool GpuPassTimer::Supported() {
+  return GLEW_VERSION_3_3 || GLEW_ARB_timer_query;
+}
+
+void GpuPassTimer::Init() {
+  supported = Supported();
+  if (supported) {
+    glGenQueries(num_of_queries, queries);
+  }
+}
+
+void GpuPassTimer::Begin() {
+  cpu_start = std::chrono::steady_clock::now();
+  if (!supported) {
+    return;
+  }
+  GLuint query = queries[next_query];
+  // The query is reused this frame, its previous result is read if the GPU is done with it and dropped otherwise
+  if (issued[next_query]) {
+    GLint available = GL_FALSE;
+    glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+    if (available) {
+      GLuint64 nanoseconds = 0;
+      glGetQueryObjectui64v(query, GL_QUERY_RESULT, &nanoseconds);
+      gpu_total_ms += nanoseconds / 1e6;
+      gpu_count += 1;
+    }
+    else {
+      skipped += 1;
+    }
+  }
+  glBeginQuery(GL_TIME_ELAPSED, query);
+}
+
+void GpuPassTimer::End() {
+  if (supported) {
+    glEndQuery(GL_TIME_ELAPSED);
+    issued[next_query] = true;
+    next_query = (next_query + 1) % num_of_queries;
+  }
+  cpu_total_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - cpu_start).count();
+  cpu_count += 1;
+}
+
+GpuPassTimer::Means GpuPassTimer::TakeMeans() {
+  Means means;
+  means.cpu_ms = cpu_count > 0 ? cpu_total_ms / cpu_count : 0;
+  means.gpu_ms = gpu_count > 0 ? gpu_total_ms / gpu_count : 0;
+  cpu_total_ms = 0;
+  cpu_count = 0;
+  gpu_total_ms = 0;
+  gpu_count = 0;
+  return means;
+}
+
+void GpuPassTimer::Release() {
+  if (supported) {
+    glDeleteQueries(num_of_queries, queries);
+  }
+}
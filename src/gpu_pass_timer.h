@@ -0,0 +1,38 @@
+#pragma once
+#include <chrono>
+#include "shader.h"
+
+// GPU time of a render pass, measured with a GL_TIME_ELAPSED query around its commands every frame, next to the CPU
+// time spent submitting them. The queries are double buffered, each frame reads the result of the query issued two
+// frames before, and only once it is available, so reading never stalls the pipeline. Results still pending after two
+// frames are skipped. Render thread only.
+struct GpuPassTimer {
+  static const int num_of_queries = 2;
+
+  GLuint queries[num_of_queries]{};
+  bool issued[num_of_queries]{};
+  int next_query = 0;
+  bool supported = false;
+
+  struct Means {
+    double cpu_ms = 0;
+    double gpu_ms = 0;
+  };
+
+  // Results read since the last TakeMeans
+  double cpu_total_ms = 0;
+  int cpu_count = 0;
+  double gpu_total_ms = 0;
+  int gpu_count = 0;
+  long long skipped = 0;
+  std::chrono::steady_clock::time_point cpu_start;
+
+  // GL_TIME_ELAPSED queries are core since OpenGL 3.3
+  static bool Supported();
+  void Init();
+  void Begin();
+  void End();
+  // Mean CPU and GPU times in milliseconds of the passes since the last call, 0 if there were none
+  Means TakeMeans();
+  void Release();
+};
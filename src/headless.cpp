@@ -0,0 +1,45 @@
+#include "headless.h"
+#include <iostream>
+#include "stage_timings.h"
+#include "zone_profiler.h"
+
+void RunHeadless(SimulationBackend& backend, SimulationState& state, int ticks, float delta_time) {
+  StageTimings timings;
+  backend.stage_timings = &timings;
+  double simulated_time = 0;
+
+  std::cout << "Headless " << backend.Name() << ": " << state.num_of_birds << " birds, " << ticks << " ticks of " << delta_time << " s" << std::endl;
+  StageTimings::clock::time_point run_start = StageTimings::clock::now();
+  for (int tick = 0; tick < ticks; ++tick) {
+    PROFILE_ZONE("tick");
+    // There is no averages thread, the second device's averages are updated in line
+    if (backend.SeparateFlockAverages()) {
+      PROFILE_ZONE("flock averages");
+      StageTimings::clock::time_point start = StageTimings::clock::now();
+      backend.UpdateFlockAverages();
+      timings.Add("flock averages (second device)", start);
+    }
+
+    StageTimings::clock::time_point start = StageTimings::clock::now();
+    backend.Step(delta_time);
+    timings.Add("step", start);
+    simulated_time += delta_time;
+
+    start = StageTimings::clock::now();
+    backend.Fetch(simulated_time, simulated_time);
+    timings.Add("fetch", start);
+
+    start = StageTimings::clock::now();
+    backend.Commit(false);
+    timings.Add("commit", start);
+  }
+  StageTimings::clock::time_point start = StageTimings::clock::now();
+  backend.Commit(true);
+  timings.Add("final commit", start);
+  double total_seconds = std::chrono::duration<double>(StageTimings::clock::now() - run_start).count();
+  backend.stage_timings = nullptr;
+
+  std::cout << "Total " << total_seconds << " s, " << ticks / total_seconds << " ticks/s, "
+    << (double)ticks * state.num_of_birds / total_seconds / 1e6 << " M bird updates/s" << std::endl;
+  timings.Print(std::cout, total_seconds);
+}
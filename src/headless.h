@@ -0,0 +1,7 @@
+#pragma once
+#include "simulation_backend.h"
+
+// Simulates ticks ticks of one delta_time step each on an initialised backend as fast as possible, without a
+// window or OpenGL context. The birds of every tick are fetched into the state like in the windowed host copy
+// path. Prints the throughput and the time of each stage to std::cout.
+void RunHeadless(SimulationBackend& backend, SimulationState& state, int ticks, float delta_time);
@@ -3,104 +3,277 @@
 
 using std::string;
 
-const string simulate_bird_kernel =
-"__kernel void simulate_bird(__global float* p_birds, __global unsigned int* p_bird_to_flock, __global float* p_flock_avgs, __global unsigned int* p_flock_ranges, __global float* delta_time)\n"
+// Functions shared by the simulate_bird kernel variants. They only differ in how the separation force is found.
+// Birds are double buffered: kernels read the previous tick from p_pos_in/p_dir_in and write the new tick to
+// p_pos_out/p_dir_out, so neighbour reads never see birds another work item has already moved.
+// The simulation constants (BIRD_MOV_SPEED, SEPARATION_DIST, WORLD_X_START, ...) are not defined here, the
+// programs are built with -D options from SimulationState::KernelBuildOptions so they fold at compile time.
+const string bird_functions_kernel =
+"void update_bird(__global float4* p_dir_in, __global float4* p_pos_out, __global float4* p_dir_out, __global float4* p_flock_avgs, unsigned int gid, unsigned int flock_index, float3 pos_a, float3 force, float delta_time)\n"
 "{\n"
-"	unsigned int gid = get_global_id(0);\n"
-" unsigned int flock_index = p_bird_to_flock[gid];\n"
-" "
-" float3 pos_a = vload3(gid * 2, p_birds);\n"
-" unsigned int flock_start = p_flock_ranges[flock_index * 2];\n"
-" unsigned int flock_end = p_flock_ranges[flock_index * 2 + 1];\n"
-" unsigned int index = flock_start;\n"
-" float3 force = (float3)(0,0,0);\n"
-
-// Simulate bird pairs (separation force)
-" while (index < flock_end) {\n"
-"  if (gid == index) {\n"
-"   index += 1;\n"
-"   continue;\n"
-"  }\n"
-"  float3 pos_b = vload3(index * 2, p_birds);\n"
-"  float3 delta = pos_b - pos_a;\n"
-"  float distance = length(delta);\n"
-"  if (distance < 4.0f) {\n"
-"   force -= (4.0f - distance) * normalize(delta) * 2.0f;\n"
-"  }\n"
-"  index += 1;\n"
-" }\n"
 
 // Flock alignment and cohesion forces
-" float3 flock_dir = vload3(flock_index * 2, p_flock_avgs);\n"
-" float3 flock_pos = vload3(flock_index * 2, p_flock_avgs + 3);\n"
+" float3 flock_dir = p_flock_avgs[flock_index * 2].xyz;\n"
+" float3 flock_pos = p_flock_avgs[flock_index * 2 + 1].xyz;\n"
 " // Alignment: each bird steers towards the average direction of flock birds\n"
-" force = force + flock_dir * 0.5f;\n"
+" force = force + flock_dir * ALIGNMENT_COEFFICIENT;\n"
 " // Cohesion: each bird steers towards the average position of flock birds\n"
-" force = force + normalize(flock_pos - pos_a) * 0.5f;\n"
+" force = force + normalize(flock_pos - pos_a) * COHESION_COEFFICIENT;\n"
 
 // If out of world bonds, make birds turn around
-" if (pos_a.x < -80.0f) {\n"
+" if (pos_a.x < WORLD_X_START) {\n"
 "  force += (float3)(1, 0, 0);\n"
 " }\n"
-" else if (pos_a.x > 80.0f) {\n"
+" else if (pos_a.x > WORLD_X_END) {\n"
 "  force += (float3)(-1, 0, 0);\n"
 " }\n"
-" if (pos_a.y < -50.0f) {\n"
+" if (pos_a.y < WORLD_Y_START) {\n"
 "  force += (float3)(0, 1, 0);\n"
 " }\n"
-" else if (pos_a.y > 50.0f) {\n"
+" else if (pos_a.y > WORLD_Y_END) {\n"
 "  force += (float3)(0, -1, 0);\n"
 " }\n"
-" if (pos_a.z < 20.0f) {\n"
+" if (pos_a.z < WORLD_Z_START) {\n"
 "  force += (float3)(0, 0, 2);\n"
 " }\n"
-" else if (pos_a.z > 75.0f) {\n"
+" else if (pos_a.z > WORLD_Z_END) {\n"
 "  force += (float3)(0, 0, -1);\n"
-" }"
+" }\n"
 
 // Rotate and move bird
-" float3 dir_a = vload3(gid * 2, p_birds + 3);\n"
+" float3 dir_a = p_dir_in[gid].xyz;\n"
 " force = normalize(force);\n"
 " float3 ninety = normalize((cross(cross(dir_a, force), dir_a)));\n"
-" dir_a = (float)cos(0.4f * delta_time[0]) * dir_a + (float)sin(0.4f * delta_time[0]) * ninety;\n"
-" pos_a += dir_a * 2.0f * delta_time[0];\n"
-
-" p_birds[gid * 6] = pos_a.x;\n"
-" p_birds[gid * 6 + 1] = pos_a.y;\n"
-" p_birds[gid * 6 + 2] = pos_a.z;\n"
-" p_birds[gid * 6 + 3] = dir_a.x;\n"
-" p_birds[gid * 6 + 4] = dir_a.y;\n"
-" p_birds[gid * 6 + 5] = dir_a.z;\n"
+" dir_a = (float)cos(BIRD_ROT_SPEED * delta_time) * dir_a + (float)sin(BIRD_ROT_SPEED * delta_time) * ninety;\n"
+" pos_a += dir_a * BIRD_MOV_SPEED * delta_time;\n"
+
+" p_pos_out[gid] = (float4)(pos_a, 0.0f);\n"
+" p_dir_out[gid] = (float4)(dir_a, 0.0f);\n"
 "}\n";
 
-const size_t char_simulate_bird_size = simulate_bird_kernel.length();
-const char* char_simulate_bird = { (simulate_bird_kernel.c_str()) };
+const char* char_bird_functions = { (bird_functions_kernel.c_str()) };
 
 
-const string calc_flock_avgs_kernel =
-"__kernel void calc_flock_avgs(__global float* p_birds, __global float* p_flock_avgs, __global unsigned int* p_flock_ranges)\n"
+// All-pairs separation for flocks too small for the grid to be worth building. Positions are loaded
+// cooperatively into local memory one tile (work group size) at a time, so each position is read from
+// global memory once per work group instead of once per work item. The work group covers a contiguous
+// run of birds, so the tiles span the flocks of its first and last bird.
+const string simulate_bird_tiled_kernel =
+"__kernel void simulate_bird_tiled(__global float4* p_pos_in, __global float4* p_dir_in, __global float4* p_pos_out, __global float4* p_dir_out, __global unsigned int* p_bird_to_flock, __global float4* p_flock_avgs, __global unsigned int* p_flock_ranges, float delta_time, unsigned int num_of_birds, __local float4* p_tile)\n"
 "{\n"
-"	unsigned int flock_index = get_global_id(0);\n"
+"	unsigned int gid = get_global_id(0);\n"
+" unsigned int lid = get_local_id(0);\n"
+" unsigned int tile_size = get_local_size(0);\n"
+// Work items past the last bird still have to take part in the tile loads and barriers
+" bool active = gid < num_of_birds;\n"
+" unsigned int bird = active ? gid : num_of_birds - 1;\n"
+" unsigned int flock_index = p_bird_to_flock[bird];\n"
+" float3 pos_a = p_pos_in[bird].xyz;\n"
 " unsigned int flock_start = p_flock_ranges[flock_index * 2];\n"
 " unsigned int flock_end = p_flock_ranges[flock_index * 2 + 1];\n"
-" float3 flock_dir = (float3)(0,0,0);\n"
-" float3 flock_pos = (float3)(0,0,0);\n"
+" unsigned int group_first = get_group_id(0) * tile_size;\n"
+" unsigned int group_last = min(group_first + tile_size, num_of_birds) - 1;\n"
+" unsigned int tiles_start = p_flock_ranges[p_bird_to_flock[group_first] * 2];\n"
+" unsigned int tiles_end = p_flock_ranges[p_bird_to_flock[group_last] * 2 + 1];\n"
+" float3 force = (float3)(0,0,0);\n"
+
+// Simulate bird pairs (separation force)
+" for (unsigned int tile_start = tiles_start; tile_start < tiles_end; tile_start += tile_size) {\n"
+"  if (tile_start + lid < tiles_end) {\n"
+"   p_tile[lid] = p_pos_in[tile_start + lid];\n"
+"  }\n"
+"  barrier(CLK_LOCAL_MEM_FENCE);\n"
+"  unsigned int index = max(tile_start, flock_start);\n"
+"  unsigned int index_end = min(tile_start + tile_size, flock_end);\n"
+"  while (index < index_end) {\n"
+"   if (gid == index) {\n"
+"    index += 1;\n"
+"    continue;\n"
+"   }\n"
+"   float3 delta = p_tile[index - tile_start].xyz - pos_a;\n"
+"   float distance = length(delta);\n"
+"   if (distance < SEPARATION_DIST) {\n"
+"    force -= (SEPARATION_DIST - distance) * normalize(delta) * SEPARATION_FORCE_COEFFICIENT;\n"
+"   }\n"
+"   index += 1;\n"
+"  }\n"
+"  barrier(CLK_LOCAL_MEM_FENCE);\n"
+" }\n"
+
+" if (active) {\n"
+"  update_bird(p_dir_in, p_pos_out, p_dir_out, p_flock_avgs, gid, flock_index, pos_a, force, delta_time);\n"
+" }\n"
+"}\n";
+
+const char* char_simulate_bird_tiled = { (simulate_bird_tiled_kernel.c_str()) };
+
+
+// Uniform grid for the separation pass. Every tick the birds are counting sorted by cell:
+// count_grid_cells counts birds per cell, scan_grid_cells turns the counts into cell start offsets
+// and scatter_grid_birds writes a copy of the positions ordered by cell. simulate_bird_grid then
+// only visits the 27 cells around each bird. Each flock has its own grid, as birds only separate
+// from birds of their own flock.
+const string spatial_grid_kernel =
+"int3 grid_cell_coords(float3 pos, float4 grid_origin, int4 grid_dims, float cell_size)\n"
+"{\n"
+" int3 coords = convert_int3_sat_rtn((pos - grid_origin.xyz) / cell_size);\n"
+" return clamp(coords, (int3)(0, 0, 0), grid_dims.xyz - 1);\n"
+"}\n"
+
+"unsigned int grid_cell_index(unsigned int flock_index, int3 coords, int4 grid_dims)\n"
+"{\n"
+" return ((flock_index * grid_dims.z + coords.z) * grid_dims.y + coords.y) * grid_dims.x + coords.x;\n"
+"}\n"
+
+"__kernel void count_grid_cells(__global float4* p_pos, __global unsigned int* p_bird_to_flock, __global unsigned int* p_bird_cells, __global unsigned int* p_bird_cell_offsets, __global unsigned int* p_cell_counts, float4 grid_origin, int4 grid_dims, float cell_size)\n"
+"{\n"
+"	unsigned int gid = get_global_id(0);\n"
+" unsigned int cell = grid_cell_index(p_bird_to_flock[gid], grid_cell_coords(p_pos[gid].xyz, grid_origin, grid_dims, cell_size), grid_dims);\n"
+" p_bird_cells[gid] = cell;\n"
+" p_bird_cell_offsets[gid] = atomic_inc(&p_cell_counts[cell]);\n"
+"}\n"
+
+// Exclusive prefix sum of the cell counts, run as a single work group. Each work item sums a
+// contiguous chunk of cells, the chunk sums are scanned in local memory, then each work item
+// writes the start offsets of its chunk.
+"__kernel void scan_grid_cells(__global unsigned int* p_cell_counts, __global unsigned int* p_cell_starts, unsigned int num_of_cells, __local unsigned int* p_chunk_sums)\n"
+"{\n"
+" unsigned int lid = get_local_id(0);\n"
+" unsigned int local_size = get_local_size(0);\n"
+" unsigned int chunk_size = (num_of_cells + local_size - 1) / local_size;\n"
+" unsigned int chunk_start = min(lid * chunk_size, num_of_cells);\n"
+" unsigned int chunk_end = min(chunk_start + chunk_size, num_of_cells);\n"
+" unsigned int sum = 0;\n"
+" for (unsigned int i = chunk_start; i < chunk_end; i++) {\n"
+"  sum += p_cell_counts[i];\n"
+" }\n"
+" p_chunk_sums[lid] = sum;\n"
+" barrier(CLK_LOCAL_MEM_FENCE);\n"
+" for (unsigned int offset = 1; offset < local_size; offset *= 2) {\n"
+"  unsigned int value = lid >= offset ? p_chunk_sums[lid - offset] : 0;\n"
+"  barrier(CLK_LOCAL_MEM_FENCE);\n"
+"  p_chunk_sums[lid] += value;\n"
+"  barrier(CLK_LOCAL_MEM_FENCE);\n"
+" }\n"
+" unsigned int start = p_chunk_sums[lid] - sum;\n"
+" for (unsigned int i = chunk_start; i < chunk_end; i++) {\n"
+"  p_cell_starts[i] = start;\n"
+"  start += p_cell_counts[i];\n"
+" }\n"
+"}\n"
+
+"__kernel void scatter_grid_birds(__global float4* p_pos, __global unsigned int* p_bird_cells, __global unsigned int* p_bird_cell_offsets, __global unsigned int* p_cell_starts, __global float4* p_sorted_pos)\n"
+"{\n"
+"	unsigned int gid = get_global_id(0);\n"
+" unsigned int slot = p_cell_starts[p_bird_cells[gid]] + p_bird_cell_offsets[gid];\n"
+" p_sorted_pos[slot] = p_pos[gid];\n"
+"}\n"
+
+"__kernel void simulate_bird_grid(__global float4* p_pos_in, __global float4* p_dir_in, __global float4* p_pos_out, __global float4* p_dir_out, __global unsigned int* p_bird_to_flock, __global float4* p_flock_avgs, float delta_time, __global unsigned int* p_bird_cells, __global unsigned int* p_bird_cell_offsets, __global unsigned int* p_cell_counts, __global unsigned int* p_cell_starts, __global float4* p_sorted_pos, float4 grid_origin, int4 grid_dims, float cell_size)\n"
+"{\n"
+"	unsigned int gid = get_global_id(0);\n"
+" unsigned int flock_index = p_bird_to_flock[gid];\n"
+" float3 pos_a = p_pos_in[gid].xyz;\n"
+" unsigned int own_slot = p_cell_starts[p_bird_cells[gid]] + p_bird_cell_offsets[gid];\n"
+" int3 cell = grid_cell_coords(pos_a, grid_origin, grid_dims, cell_size);\n"
+" float3 force = (float3)(0,0,0);\n"
+
+// Simulate bird pairs in the neighbouring cells (separation force)
+" for (int dz = -1; dz <= 1; dz++) {\n"
+"  for (int dy = -1; dy <= 1; dy++) {\n"
+"   for (int dx = -1; dx <= 1; dx++) {\n"
+"    int3 coords = cell + (int3)(dx, dy, dz);\n"
+"    if (any(coords < (int3)(0, 0, 0)) || any(coords >= grid_dims.xyz)) {\n"
+"     continue;\n"
+"    }\n"
+"    unsigned int cell_index = grid_cell_index(flock_index, coords, grid_dims);\n"
+"    unsigned int slot = p_cell_starts[cell_index];\n"
+"    unsigned int slot_end = slot + p_cell_counts[cell_index];\n"
+"    for (; slot < slot_end; slot++) {\n"
+"     if (slot == own_slot) {\n"
+"      continue;\n"
+"     }\n"
+"     float3 delta = p_sorted_pos[slot].xyz - pos_a;\n"
+"     float distance = length(delta);\n"
+"     if (distance < SEPARATION_DIST) {\n"
+"      force -= (SEPARATION_DIST - distance) * normalize(delta) * SEPARATION_FORCE_COEFFICIENT;\n"
+"     }\n"
+"    }\n"
+"   }\n"
+"  }\n"
+" }\n"
+
+" update_bird(p_dir_in, p_pos_out, p_dir_out, p_flock_avgs, gid, flock_index, pos_a, force, delta_time);\n"
+"}\n";
+
+const char* char_spatial_grid = { (spatial_grid_kernel.c_str()) };
+
+
+// Flock averages as a two stage reduction. sum_flock_blocks runs blocks_per_flock work groups per
+// flock, each summing a strided share of the flock's birds in local memory into one partial sum.
+// combine_flock_sums runs one work group per flock that adds up its partial sums and writes the averages.
+const string flock_avgs_kernel =
+"__kernel void sum_flock_blocks(__global float4* p_pos, __global float4* p_dir, __global unsigned int* p_flock_ranges, __global float4* p_partial_sums, unsigned int blocks_per_flock, __local float4* p_dir_sums, __local float4* p_pos_sums)\n"
+"{\n"
+" unsigned int lid = get_local_id(0);\n"
+" unsigned int local_size = get_local_size(0);\n"
+" unsigned int group = get_group_id(0);\n"
+" unsigned int flock_index = group / blocks_per_flock;\n"
+" unsigned int block = group % blocks_per_flock;\n"
+" unsigned int flock_start = p_flock_ranges[flock_index * 2];\n"
+" unsigned int flock_end = p_flock_ranges[flock_index * 2 + 1];\n"
+" float4 dir_sum = (float4)(0,0,0,0);\n"
+" float4 pos_sum = (float4)(0,0,0,0);\n"
+" for (unsigned int i = flock_start + block * local_size + lid; i < flock_end; i += blocks_per_flock * local_size) {\n"
+"  dir_sum += p_dir[i];\n"
+"  pos_sum += p_pos[i];\n"
+" }\n"
+" p_dir_sums[lid] = dir_sum;\n"
+" p_pos_sums[lid] = pos_sum;\n"
+" barrier(CLK_LOCAL_MEM_FENCE);\n"
+" for (unsigned int stride = local_size / 2; stride > 0; stride /= 2) {\n"
+"  if (lid < stride) {\n"
+"   p_dir_sums[lid] += p_dir_sums[lid + stride];\n"
+"   p_pos_sums[lid] += p_pos_sums[lid + stride];\n"
+"  }\n"
+"  barrier(CLK_LOCAL_MEM_FENCE);\n"
+" }\n"
+" if (lid == 0) {\n"
+"  p_partial_sums[group * 2] = p_dir_sums[0];\n"
+"  p_partial_sums[group * 2 + 1] = p_pos_sums[0];\n"
+" }\n"
+"}\n"
+
+"__kernel void combine_flock_sums(__global float4* p_partial_sums, __global float4* p_flock_avgs, __global unsigned int* p_flock_ranges, unsigned int blocks_per_flock, __local float4* p_dir_sums, __local float4* p_pos_sums)\n"
+"{\n"
+" unsigned int lid = get_local_id(0);\n"
+" unsigned int local_size = get_local_size(0);\n"
+"	unsigned int flock_index = get_group_id(0);\n"
+" float4 dir_sum = (float4)(0,0,0,0);\n"
+" float4 pos_sum = (float4)(0,0,0,0);\n"
+" for (unsigned int block = lid; block < blocks_per_flock; block += local_size) {\n"
+"  dir_sum += p_partial_sums[(flock_index * blocks_per_flock + block) * 2];\n"
+"  pos_sum += p_partial_sums[(flock_index * blocks_per_flock + block) * 2 + 1];\n"
+" }\n"
+" p_dir_sums[lid] = dir_sum;\n"
+" p_pos_sums[lid] = pos_sum;\n"
+" barrier(CLK_LOCAL_MEM_FENCE);\n"
+" for (unsigned int stride = local_size / 2; stride > 0; stride /= 2) {\n"
+"  if (lid < stride) {\n"
+"   p_dir_sums[lid] += p_dir_sums[lid + stride];\n"
+"   p_pos_sums[lid] += p_pos_sums[lid + stride];\n"
+"  }\n"
+"  barrier(CLK_LOCAL_MEM_FENCE);\n"
+" }\n"
 
 // Update flock averages
-" for (int i = flock_start; i < flock_end; i++) {\n"
-"  flock_dir += vload3(i * 2, p_birds + 3);\n"
-"  flock_pos += vload3(i * 2, p_birds); \n"
-" }\n"
-" float num_of_birds = flock_end - flock_start;\n"
-" flock_dir = normalize(flock_dir / (float)num_of_birds);\n"
-" flock_pos = flock_pos / (float)num_of_birds;\n"
-" p_flock_avgs[flock_index * 6] = flock_dir.x;\n"
-" p_flock_avgs[flock_index * 6 + 1] = flock_dir.y;\n"
-" p_flock_avgs[flock_index * 6 + 2] = flock_dir.z;\n"
-" p_flock_avgs[flock_index * 6 + 3] = flock_pos.x;\n"
-" p_flock_avgs[flock_index * 6 + 4] = flock_pos.y;\n"
-" p_flock_avgs[flock_index * 6 + 5] = flock_pos.z;\n"
+" if (lid == 0) {\n"
+"  float num_of_birds = p_flock_ranges[flock_index * 2 + 1] - p_flock_ranges[flock_index * 2];\n"
+"  float3 flock_dir = normalize(p_dir_sums[0].xyz / num_of_birds);\n"
+"  float3 flock_pos = p_pos_sums[0].xyz / num_of_birds;\n"
+"  p_flock_avgs[flock_index * 2] = (float4)(flock_dir, 0.0f);\n"
+"  p_flock_avgs[flock_index * 2 + 1] = (float4)(flock_pos, 0.0f);\n"
+" }\n"
 "}\n";
 
-const size_t char_calc_flock_avgs_size = calc_flock_avgs_kernel.length();
-const char* char_calc_flock_avgs = { (calc_flock_avgs_kernel.c_str()) };
\ No newline at end of file
+const char* char_flock_avgs = { (flock_avgs_kernel.c_str()) };
@@ -1,6 +1,13 @@
 #include <iostream>
 #include <sstream>
 #include <string>
+#include <vector>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <iomanip>
+#include <atomic>
+#include <thread>
 #define GLEW_STATIC 1
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
@@ -11,15 +18,35 @@
 #include "stb_image.h" // For loading textures
 #include "shader.h"
 #include "simulation_state.h"
-#include <CL/opencl.h>
-#include "kernels.h"
+#include "tick_scheduler.h"
+#include "bird_render_slots.h"
+#include "bird_snapshots.h"
+#include "gpu_pass_timer.h"
+#include "opencl_backend.h"
+#include "cl_gl_sharing.h"
+#include "native_backend.h"
+#include "headless.h"
+#include "zone_profiler.h"
 
 using glm::vec3;
+using glm::vec4;
 using glm::mat4;
 using std::stringstream;
 using std::endl;
 using std::cout;
 
+// Parses the whole of text as a float, false if it isn't one
+bool ParseFloat(const char* text, float& value) {
+  try {
+    size_t length = 0;
+    value = std::stof(text, &length);
+    return text[length] == '\0';
+  }
+  catch (const std::exception&) {
+    return false;
+  }
+}
+
 // Load a texture from a file. Texture loading code from https://learnopengl.com/Getting-started/Textures
 GLuint LoadTextureAlpha(string filename) {
   int texture_width;
@@ -38,17 +65,211 @@ GLuint LoadTextureAlpha(string filename) {
   return texture;
 };
 
-void DrawBird(Bird& bird, Shader& shader) {
-  mat4 model = mat4(1.0f);
-  model = glm::translate(model, bird.pos);
-  model = glm::rotate(model, atan2(bird.dir.y, bird.dir.x), vec3(0.0f, 0.0f, 1.0f));
-  shader.SetMatrix4fv("model", model);
-
-  glDrawArrays(GL_TRIANGLES, 0, 3);
+// Interpolation factor between the previous and latest simulated state, drawing one tick behind
+float InterpolationAlpha(double simulated_time, double prev_simulated_time, TickScheduler::clock::time_point commit_clock_time) {
+  if (simulated_time <= prev_simulated_time) {
+    return 1.0f;
+  }
+  double time_since_commit = std::chrono::duration<double>(TickScheduler::clock::now() - commit_clock_time).count();
+  return (float)std::min(time_since_commit / (simulated_time - prev_simulated_time), 1.0);
 }
 
 int main(int argc, char* argv[])
 {
+  // --backend opencl (default) simulates with the OpenCL kernels, --backend native with the native TBB implementation,
+  // which doesn't need an OpenCL runtime
+  bool use_native_backend = false;
+  // SIMD instruction set of the native separation loop, the widest the CPU supports unless --simd scalar|sse|avx2|avx512 asks for less
+  SimdLevel simd_level = DetectSimdLevel();
+  // By default flock averages are computed on the simulation device, in the same queue as the simulation.
+  // --two-device computes them on a CPU OpenCL device in a separate thread instead.
+  bool two_device_pipeline = false;
+  // --fixed-dt simulates in fixed steps of 1 / sim rate (at most --max-substeps per tick) and interpolates between ticks when drawing
+  bool fixed_timestep = false;
+  int max_substeps = 4;
+  // OpenCL devices are scored by a short micro-benchmark unless --no-device-benchmark, --cl-device N picks the
+  // simulation device by its index in the device list printed at startup
+  bool benchmark_devices = true;
+  int requested_device = -1;
+  // --cl-profile prints the device side durations of every OpenCL command every few seconds
+  bool profile_commands = false;
+  // --trace FILE records a timeline of the ticks, uploads, device waits, draws and swaps on every thread and writes it
+  // to FILE as Chrome trace event JSON on exit, see zone_profiler.h
+  string trace_path;
+  // --headless --ticks N simulates N ticks of 1 / sim rate as fast as possible without a window or OpenGL context,
+  // then prints the throughput and per stage timings. It returns before glfwInit and the backends make no OpenGL
+  // calls, and opengl32.dll is delay loaded, so it also runs on hosts without an OpenGL driver.
+  bool headless = false;
+  int headless_ticks = 1000;
+  // --birds N sizes the simulation for N birds (rounded up to fill the flocks evenly), --flocks N splits them into N flocks
+  int requested_birds = SimulationState::default_birds;
+  int requested_flocks = SimulationState::max_flocks;
+  // Built kernels are cached in --kernel-cache DIR (default kernel_cache), --no-kernel-cache always compiles from source
+  string kernel_cache_directory = "kernel_cache";
+  // The birds are handed to OpenGL on the device when the simulation device supports cl_khr_gl_sharing,
+  // --no-gl-sharing always reads them back through the host instead
+  bool allow_gl_sharing = true;
+  // Without sharing the birds are read back into persistently mapped vertex buffers when OpenGL supports it,
+  // --no-persistent-mapping uploads them from the simulation state every frame instead
+  bool allow_persistent_mapping = true;
+  // Rates of the simulation, averages (--two-device only) and render loops, in updates per second
+  double sim_rate = 30;
+  double avgs_rate = 30;
+  double draw_rate = 30;
+  for (int i = 1; i < argc; ++i) {
+    string arg = argv[i];
+    if (arg == "--backend" && i + 1 < argc) {
+      string backend = argv[++i];
+      if (backend != "native" && backend != "opencl") {
+        std::cerr << "Unknown --backend " << backend << ", expected opencl or native" << endl;
+        return -1;
+      }
+      use_native_backend = backend == "native";
+    }
+    else if (arg == "--simd" && i + 1 < argc) {
+      if (!ParseSimdLevel(argv[++i], simd_level)) {
+        std::cerr << "Unknown --simd level " << argv[i] << ", expected scalar, sse, avx2 or avx512" << endl;
+        return -1;
+      }
+    }
+    else if (arg == "--two-device") {
+      two_device_pipeline = true;
+    }
+    else if (arg == "--fixed-dt") {
+      fixed_timestep = true;
+    }
+    else if (arg == "--no-gl-sharing") {
+      allow_gl_sharing = false;
+    }
+    else if (arg == "--no-persistent-mapping") {
+      allow_persistent_mapping = false;
+    }
+    else if (arg == "--no-device-benchmark") {
+      benchmark_devices = false;
+    }
+    else if (arg == "--cl-device" && i + 1 < argc) {
+      requested_device = std::stoi(argv[++i]);
+    }
+    else if (arg == "--cl-profile") {
+      profile_commands = true;
+    }
+    else if (arg == "--trace" && i + 1 < argc) {
+      trace_path = argv[++i];
+    }
+    else if (arg == "--headless") {
+      headless = true;
+    }
+    else if (arg == "--ticks" && i + 1 < argc) {
+      headless_ticks = std::max(1, std::stoi(argv[++i]));
+    }
+    else if (arg == "--birds" && i + 1 < argc) {
+      requested_birds = std::max(1, std::stoi(argv[++i]));
+    }
+    else if (arg == "--flocks" && i + 1 < argc) {
+      requested_flocks = std::stoi(argv[++i]);
+    }
+    else if (arg == "--kernel-cache" && i + 1 < argc) {
+      kernel_cache_directory = argv[++i];
+    }
+    else if (arg == "--no-kernel-cache") {
+      kernel_cache_directory.clear();
+    }
+    else if (arg == "--max-substeps" && i + 1 < argc) {
+      max_substeps = std::max(1, std::stoi(argv[++i]));
+    }
+    else if (arg == "--sim-rate" && i + 1 < argc) {
+      sim_rate = std::stod(argv[++i]);
+    }
+    else if (arg == "--avgs-rate" && i + 1 < argc) {
+      avgs_rate = std::stod(argv[++i]);
+    }
+    else if (arg == "--draw-rate" && i + 1 < argc) {
+      draw_rate = std::stod(argv[++i]);
+    }
+  }
+  // The schedulers and the fixed timestep divide by the rates
+  if (!(sim_rate > 0) || !(avgs_rate > 0) || !(draw_rate > 0)) {
+    std::cerr << "--sim-rate, --avgs-rate and --draw-rate must be greater than 0" << endl;
+    return -1;
+  }
+  // The native backend computes the flock averages itself
+  two_device_pipeline = two_device_pipeline && !use_native_backend;
+
+  if (!trace_path.empty()) {
+    EnableZoneProfiler();
+    SetZoneThreadName("main");
+  }
+  auto write_trace = [&]() {
+    if (!trace_path.empty()) {
+      if (WriteChromeTrace(trace_path)) {
+        cout << "Trace written to " << trace_path << endl;
+      }
+      else {
+        std::cerr << "Failed to write the trace to " << trace_path << endl;
+      }
+    }
+  };
+
+  // Initialize random seed
+  srand((unsigned long)time(0));
+
+  // Heap allocated, the bird arrays are sized at runtime
+  SimulationState state(requested_birds, requested_flocks);
+  // Bird behaviour overrides, the kernels are built for the resulting values
+  for (int i = 1; i + 1 < argc; ++i) {
+    string arg = argv[i];
+    float* parameter = arg == "--bird-speed" ? &state.bird_mov_speed
+      : arg == "--turn-rate" ? &state.bird_rot_speed
+      : arg == "--separation-dist" ? &state.separation_dist
+      : arg == "--separation-force" ? &state.separation_force_coefficient
+      : arg == "--alignment" ? &state.flock_alignment_coefficient
+      : arg == "--cohesion" ? &state.flock_cohesion_coefficient
+      : nullptr;
+    if (parameter != nullptr && !ParseFloat(argv[++i], *parameter)) {
+      std::cerr << arg << " expects a number, got " << argv[i] << endl;
+      return -1;
+    }
+  }
+  if (!state.ValidBehaviour()) {
+    return -1;
+  }
+  state.CreateFlocks();
+
+  // Compute engine, see SimulationBackend
+  ProgramCache program_cache;
+  program_cache.binary_directory = kernel_cache_directory;
+  OpenCLBackend opencl_backend;
+  NativeBackend native_backend;
+  native_backend.simd_level = simd_level;
+  SimulationBackend* backend = &opencl_backend;
+  if (use_native_backend) {
+    backend = &native_backend;
+  }
+  else {
+    opencl_backend.two_device_pipeline = two_device_pipeline;
+    opencl_backend.program_cache = &program_cache;
+    opencl_backend.benchmark_devices = benchmark_devices;
+    opencl_backend.requested_device = requested_device;
+    opencl_backend.profile_commands = profile_commands;
+  }
+  auto init_backend = [&]() {
+    if (!backend->Init(state)) {
+      // Without a usable OpenCL device the simulation still runs on the host
+      std::cerr << "Failed to initialise the " << backend->Name() << " backend, falling back to the native backend" << std::endl;
+      backend->Shutdown();
+      backend = &native_backend;
+      backend->Init(state);
+    }
+  };
+
+  if (headless) {
+    init_backend();
+    RunHeadless(*backend, state, headless_ticks, (float)(1.0 / sim_rate));
+    backend->Shutdown();
+    write_trace();
+    return 0;
+  }
+
   glfwInit();
 
 #if defined(PLATFORM_OSX)	
@@ -61,12 +282,6 @@ int main(int argc, char* argv[])
   glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
 #endif
 
-  // Initialize random seed
-  srand((unsigned long)time(0));
-
-  SimulationState state = SimulationState();
-  state.CreateFlocks();
-
   // Enable multi-sampling (anti-aliasing)
   glfwWindowHint(GLFW_SAMPLES, 16);
   glEnable(GL_MULTISAMPLE);
@@ -145,6 +360,29 @@ int main(int argc, char* argv[])
   glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
   glEnableVertexAttribArray(0);
 
+  // Birds are drawn as instances of the triangle. Position and direction (and the previous tick's, for interpolation)
+  // are per instance attributes uploaded every frame from the newest snapshot, the model transform is built in bird_v.glsl.
+  GLuint bird_instance_vbos[4];
+  vec4* bird_instance_data[4] = { state.bird_pos, state.bird_dir, state.prev_bird_pos, state.prev_bird_dir };
+  size_t bird_instance_data_size = sizeof(vec4) * state.num_of_birds;
+  glGenBuffers(4, bird_instance_vbos);
+  for (int i = 0; i < 4; ++i) {
+    glBindBuffer(GL_ARRAY_BUFFER, bird_instance_vbos[i]);
+    glBufferData(GL_ARRAY_BUFFER, bird_instance_data_size, bird_instance_data[i], GL_STREAM_DRAW);
+    glVertexAttribPointer(i + 1, 4, GL_FLOAT, GL_FALSE, 0, (void*)0);
+    glEnableVertexAttribArray(i + 1);
+    glVertexAttribDivisor(i + 1, 1);
+  }
+
+  // The flock of each bird picks its colour, it never changes
+  GLuint bird_flock_vbo = 0;
+  glGenBuffers(1, &bird_flock_vbo);
+  glBindBuffer(GL_ARRAY_BUFFER, bird_flock_vbo);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(cl_uint) * state.num_of_birds, state.bird_to_flock, GL_STATIC_DRAW);
+  glVertexAttribIPointer(5, 1, GL_UNSIGNED_INT, 0, (void*)0);
+  glEnableVertexAttribArray(5);
+  glVertexAttribDivisor(5, 1);
+
   float grid_points[] = {
      200.0f,  200.0f, 0.0f, 35.0f, 35.0f,  // top right
      200.0f, -200.0f, 0.0f, 35.0f, 0.0f, // bottom right
@@ -184,229 +422,170 @@ int main(int argc, char* argv[])
     vec3(0.8f, 0.47451f, 0.654902f),
   };
 
-  string window_title = "Bird Flock Simulation";
-
-
-  // OpenCL variables
-
-  cl_float* p_birds = &(state.birds[0].pos[0]);
-
-  cl_uint* p_bird_to_flock = state.bird_to_flock;
-
-  cl_float* p_flock_avgs = &(state.flocks[0].avgdir[0]);
-
-  cl_uint* p_flock_ranges = state.flock_ranges;
-
-  cl_int err;
-
-  cl_uint num_platforms;
-
-  cl_context gpu_context;
-  cl_context cpu_context;
-
-  cl_command_queue queue_gpu;
-  cl_command_queue queue_cpu;
-
-  cl_program program_gpu;
-  cl_program program_cpu;
-
-  cl_kernel simulate_bird_kernel;
-  cl_kernel calc_flock_avgs_kernel;
-
-  cl_mem birds_buffer_gpu, bird_to_flock_buffer, flock_avgs_buffer_gpu, flock_ranges_buffer_gpu, time_input_buffer;
-  cl_mem birds_buffer_cpu, flock_avgs_buffer_cpu, flock_ranges_buffer_cpu;
-
-  size_t birds_buffer_size = (sizeof(cl_float) * 6 * state.max_birds), bird_to_flock_buffer_size = (sizeof(cl_uint) * state.max_birds), flock_avgs_buffer_size = (sizeof(cl_float) * 6 * state.max_flocks), flock_ranges_buffer_size = (sizeof(cl_uint) * 2 * state.max_flocks), time_input_buffer_size = sizeof(cl_float);
+  glUseProgram(bird_shader.id);
+  bird_shader.Set3fv("flock_colors", flock_colors, 7);
 
-  // OpenCL setup
-
-  err = clGetPlatformIDs(0, NULL, &num_platforms);
-  cl_platform_id* platform_ids = new cl_platform_id[num_platforms];
-  err = clGetPlatformIDs(num_platforms, platform_ids, NULL);
-  const cl_context_properties properties[] = { CL_CONTEXT_PLATFORM, (cl_context_properties)platform_ids[0], 0 };
-  const cl_context_properties properties2[] = { CL_CONTEXT_PLATFORM, (cl_context_properties)(platform_ids[1]), 0};
-
-
-  gpu_context = clCreateContextFromType(properties, CL_DEVICE_TYPE_GPU, NULL, NULL, &err);
-  cpu_context = clCreateContextFromType(properties2, CL_DEVICE_TYPE_CPU, NULL, NULL, &err);
-
-
-  // Setup GPU kernel
-  size_t databytes;
-  err = clGetContextInfo(gpu_context, CL_CONTEXT_DEVICES, 0, NULL, &databytes);
-
-  cl_device_id device_ids[6];
-
-  clGetContextInfo(gpu_context, CL_CONTEXT_DEVICES, databytes, device_ids, NULL);
-
-  queue_gpu = clCreateCommandQueue(gpu_context, device_ids[0], 0, &err);
-
-  const char* source[1] = { char_simulate_bird }; // array of pointers where each pointer points to a string
-  cl_uint count = 1; // size of the source array
-
-  // Create Program with all kernels
-  program_gpu = clCreateProgramWithSource(gpu_context, count, source, NULL, &err);
-
-  // Build Program
-  err = clBuildProgram(program_gpu, NULL, 0, NULL, NULL, NULL);
-
-  char compiler_output[4000]{}; // size must be larger than 'length' var
-  size_t length;
-  clGetProgramBuildInfo(program_gpu, device_ids[0], CL_PROGRAM_BUILD_LOG, sizeof(compiler_output), compiler_output, &length);
-  //printf("%s", compiler_output);
-
-  // Create Kernels
-  simulate_bird_kernel = clCreateKernel(program_gpu, "simulate_bird", &err);
-
-  float delta_time = 0;
-  // Setup Buffers
-  birds_buffer_gpu = clCreateBuffer(gpu_context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, birds_buffer_size, p_birds, &err);
-  bird_to_flock_buffer = clCreateBuffer(gpu_context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, bird_to_flock_buffer_size, p_bird_to_flock, &err);
-  flock_avgs_buffer_gpu = clCreateBuffer(gpu_context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, flock_avgs_buffer_size, p_flock_avgs, &err);
-  flock_ranges_buffer_gpu = clCreateBuffer(gpu_context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, flock_ranges_buffer_size, p_flock_ranges, &err);
-  time_input_buffer = clCreateBuffer(gpu_context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, time_input_buffer_size, &delta_time, &err);
-
-  // Set arguments
-  err = clSetKernelArg(simulate_bird_kernel, 0, sizeof(cl_mem), (void*)&birds_buffer_gpu);
-  err = clSetKernelArg(simulate_bird_kernel, 1, sizeof(cl_mem), (void*)&bird_to_flock_buffer);
-  err = clSetKernelArg(simulate_bird_kernel, 2, sizeof(cl_mem), (void*)&flock_avgs_buffer_gpu);
-  err = clSetKernelArg(simulate_bird_kernel, 3, sizeof(cl_mem), (void*)&flock_ranges_buffer_gpu);
-  err = clSetKernelArg(simulate_bird_kernel, 4, sizeof(cl_mem), (void*)&time_input_buffer);
-  
-  size_t gpu_work_dims[1]{ state.max_birds };
-
-
-
-
-  // Setup CPU kernel
-  err = clGetContextInfo(cpu_context, CL_CONTEXT_DEVICES, 0, NULL, &databytes);
-
-  clGetContextInfo(cpu_context, CL_CONTEXT_DEVICES, databytes, device_ids, NULL);
-
-  queue_cpu = clCreateCommandQueue(cpu_context, device_ids[0], 0, &err);
-
-  source[0] = { char_calc_flock_avgs }; // array of pointers where each pointer points to a string
-  count = 1; // size of the source array
-
-  // Create Program with all kernels
-  program_cpu = clCreateProgramWithSource(cpu_context, count, source, NULL, &err);
-
-  // Build Program
-  err = clBuildProgram(program_cpu, NULL, 0, NULL, NULL, NULL);
+  string window_title = "Bird Flock Simulation";
 
-  clGetProgramBuildInfo(program_cpu, device_ids[0], CL_PROGRAM_BUILD_LOG, sizeof(compiler_output), compiler_output, &length);
-  //printf("%s", compiler_output);
+  // CPU submission and GPU execution time of the grid and bird passes, shown in the title
+  GpuPassTimer grid_pass_timer;
+  GpuPassTimer bird_pass_timer;
+  grid_pass_timer.Init();
+  bird_pass_timer.Init();
 
-  // Create Kernels
-  calc_flock_avgs_kernel = clCreateKernel(program_cpu, "calc_flock_avgs", &err);
 
-  // Setup Buffers
-  birds_buffer_cpu = clCreateBuffer(cpu_context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, birds_buffer_size, p_birds, &err);
-  flock_avgs_buffer_cpu = clCreateBuffer(cpu_context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, flock_avgs_buffer_size, p_flock_avgs, &err);
-  flock_ranges_buffer_cpu = clCreateBuffer(cpu_context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, flock_ranges_buffer_size, p_flock_ranges, &err);
+  if (allow_gl_sharing) {
+    GLSharingContextProperties(window, opencl_backend.gl_share_properties);
+  }
+  init_backend();
+
+  // With sharing, each tick's birds are copied on the device into the render slot's vertex buffers
+  BirdRenderSlots render_slots;
+  bool use_render_slots = false;
+  if (backend->SharesGLBuffers()) {
+    render_slots.Init(triangle_vbo, bird_flock_vbo, state, false);
+    use_render_slots = backend->AttachRenderSlots(render_slots);
+    if (!use_render_slots) {
+      render_slots.Release();
+    }
+  }
+  bool gl_sharing = use_render_slots;
+  // Otherwise the birds of each tick go straight into the render slot's mapped buffers
+  bool persistent_mapping = false;
+  if (!gl_sharing && allow_persistent_mapping && BirdRenderSlots::PersistentMappingSupported()) {
+    render_slots.Init(triangle_vbo, bird_flock_vbo, state, true);
+    persistent_mapping = backend->AttachRenderSlots(render_slots);
+    use_render_slots = persistent_mapping;
+    if (!persistent_mapping) {
+      render_slots.Release();
+    }
+  }
+  // Otherwise whole ticks are handed over as snapshots in host memory and uploaded every frame
+  BirdSnapshots snapshots;
+  if (!use_render_slots) {
+    snapshots.Init(state);
+    backend->snapshots = &snapshots;
+  }
 
-  // Set arguments
-  err = clSetKernelArg(calc_flock_avgs_kernel, 0, sizeof(cl_mem), (void*)&birds_buffer_cpu);
-  err = clSetKernelArg(calc_flock_avgs_kernel, 1, sizeof(cl_mem), (void*)&flock_avgs_buffer_cpu);
-  err = clSetKernelArg(calc_flock_avgs_kernel, 2, sizeof(cl_mem), (void*)&flock_ranges_buffer_cpu);
+  // Shared between the simulation, averages and render threads
+  std::atomic<bool> sim_running{ true };
+  std::atomic<int> final_ticks{ 0 };
+  std::atomic<int> final_flock_avgs_ticks{ 0 };
+  int final_fps = 0;
 
-  size_t cpu_work_dims[1]{ state.num_of_flocks };
+  float fixed_delta_time = (float)(1.0 / sim_rate);
+  std::atomic<int> dropped_steps{ 0 }; // counted by the simulation thread, shown by the render thread
 
-  bool sim_running = true;
-  int final_fps = 0;
-  int final_ticks = 0;
-  int final_flock_avgs_ticks = 0;
+  TickScheduler sim_scheduler(sim_rate);
+  TickScheduler avgs_scheduler(avgs_rate);
+  TickScheduler draw_scheduler(draw_rate);
 
   std::thread sim_thread([&]() {
+    SetZoneThreadName("simulation");
     float time_of_last_tick_update = 0;
     int update_count = 0;
     float last_tick_update_time = 0;
+    double accumulator = 0; // wall clock time not yet simulated, fixed timestep only
+    double simulated_time = 0;
 
     while (sim_running) {
-      float sim_time = (float)glfwGetTime();
-      delta_time = sim_time - last_tick_update_time;
-      if (delta_time < (1.0f / 31)) { // cap the update rate to 30/s
-        continue;
+      float sim_time;
+      {
+        PROFILE_ZONE("wait for tick");
+        sim_time = (float)sim_scheduler.WaitForNextTick();
       }
+      PROFILE_ZONE("tick");
+      float delta_time = sim_time - last_tick_update_time;
       last_tick_update_time = sim_time;
 
-      err = clEnqueueWriteBuffer(queue_gpu, time_input_buffer, CL_TRUE, 0, time_input_buffer_size, &delta_time, 0, NULL, NULL);
-      err = clEnqueueWriteBuffer(queue_gpu, flock_avgs_buffer_gpu, CL_TRUE, 0, flock_avgs_buffer_size, p_flock_avgs, 0, NULL, NULL);
-
-      // Run the kernel
-      err = clEnqueueNDRangeKernel(queue_gpu, // command queue
-        simulate_bird_kernel, // kernel
-        1, // the number of dimensions used (1 to 3) (ex give 2 to work on a 2d matrix)
-        NULL, // useless param, always NULL
-        gpu_work_dims, // an array containing the size of each dimension for the entire kernel (for example m and n for a 2d matrix)
-        NULL, // an array containing the size of each dimension for a single work group (a kernel is separated into work groups). NULL means let OpenCL automatically decide
-        0, // event thing
-        NULL, // event thing
-        NULL // event thing
-      );
-      clFinish(queue_gpu);
-      err = clEnqueueReadBuffer(queue_gpu, birds_buffer_gpu, CL_TRUE, 0, birds_buffer_size, p_birds, 0, NULL, NULL);
-
-      update_count += 1;
+      // Commit every tick that finished while sleeping, without blocking
+      {
+        PROFILE_ZONE("commit");
+        backend->Commit(false);
+      }
+
+      // With a fixed timestep the wall clock time is simulated in steps of fixed_delta_time, with at most
+      // max_substeps steps per tick. Time beyond that is dropped so a slow device doesn't fall further behind.
+      int num_of_steps = 1;
+      float step_delta_time = delta_time;
+      if (fixed_timestep) {
+        accumulator += delta_time;
+        num_of_steps = std::min((int)(accumulator / fixed_delta_time), max_substeps);
+        accumulator -= num_of_steps * fixed_delta_time;
+        if (accumulator >= fixed_delta_time) {
+          dropped_steps += (int)(accumulator / fixed_delta_time);
+          accumulator = std::fmod(accumulator, (double)fixed_delta_time);
+        }
+        step_delta_time = fixed_delta_time;
+        if (num_of_steps == 0) {
+          continue;
+        }
+      }
+
+      for (int step = 0; step < num_of_steps; ++step) {
+        PROFILE_ZONE("step");
+        backend->Step(step_delta_time);
+        simulated_time += step_delta_time;
+      }
+      // Only the last step of the tick is drawn, and the one before it when interpolating
+      {
+        PROFILE_ZONE("fetch");
+        backend->Fetch(simulated_time, fixed_timestep ? simulated_time - step_delta_time : simulated_time);
+      }
+
+      update_count += num_of_steps;
       if (sim_time - time_of_last_tick_update >= 1.0f) {
         final_ticks = update_count;
+        if (!backend->SeparateFlockAverages()) {
+          final_flock_avgs_ticks = update_count;
+        }
         update_count = 0;
         time_of_last_tick_update = sim_time;
       }
     }
+
+    PROFILE_ZONE("final commit");
+    backend->Commit(true);
   });
 
-  std::thread avgs_thread([&]() {
-    float time_of_last_tick_update = 0;
-    int update_count = 0;
-    float last_tick_update_time = 0;
-    float delta = 0;
+  std::thread avgs_thread;
+  if (backend->SeparateFlockAverages()) {
+    avgs_thread = std::thread([&]() {
+      SetZoneThreadName("flock averages");
+      float time_of_last_tick_update = 0;
+      int update_count = 0;
+
+      while (sim_running) {
+        float ttime;
+        {
+          PROFILE_ZONE("wait for tick");
+          ttime = (float)avgs_scheduler.WaitForNextTick();
+        }
 
-    while (sim_running) {
-      float ttime = (float)glfwGetTime();
-      delta = ttime - last_tick_update_time;
-      if (delta < (1.0f / 31)) { // cap the update rate to 30/s
-        continue;
-      }
-      last_tick_update_time = ttime;
-
-      err = clEnqueueWriteBuffer(queue_cpu, birds_buffer_cpu, CL_TRUE, 0, birds_buffer_size, p_birds, 0, NULL, NULL);
-
-      // Run the kernel
-      err = clEnqueueNDRangeKernel(queue_cpu, // command queue
-        calc_flock_avgs_kernel, // kernel
-        1, // the number of dimensions used (1 to 3) (ex give 2 to work on a 2d matrix)
-        NULL, // useless param, always NULL
-        cpu_work_dims, // an array containing the size of each dimension for the entire kernel (for example m and n for a 2d matrix)
-        NULL, // an array containing the size of each dimension for a single work group (a kernel is separated into work groups). NULL means let OpenCL automatically decide
-        0, // event thing
-        NULL, // event thing
-        NULL // event thing
-      );
-      clFinish(queue_cpu);
-
-      err = clEnqueueReadBuffer(queue_cpu, flock_avgs_buffer_cpu, CL_TRUE, 0, flock_avgs_buffer_size, p_flock_avgs, 0, NULL, NULL);
-
-      update_count += 1;
-      if (ttime - time_of_last_tick_update >= 1.0f) {
-        final_flock_avgs_ticks = update_count;
-        update_count = 0;
-        time_of_last_tick_update = ttime;
+        PROFILE_ZONE("flock averages");
+        backend->UpdateFlockAverages();
+
+        update_count += 1;
+        if (ttime - time_of_last_tick_update >= 1.0f) {
+          final_flock_avgs_ticks = update_count;
+          update_count = 0;
+          time_of_last_tick_update = ttime;
+        }
       }
-    }
-    });
+      });
+  }
 
   float time_of_last_title_update = 0;
-  float time_of_last_draw = 0;
   int update_count = 0;
-  float last_sim_update_time = 0;
+  SetZoneThreadName("render");
 
   while (!glfwWindowShouldClose(window)) {
-    float draw_time = (float)glfwGetTime();
-    if (draw_time - time_of_last_draw < 1.0f / 31) {
-      continue;
+    float draw_time;
+    {
+      PROFILE_ZONE("wait for frame");
+      draw_time = (float)draw_scheduler.WaitForNextTick();
     }
-    time_of_last_draw = draw_time;
+    PROFILE_ZONE("frame");
 
     mat4 view = mat4(1.0f);
     view = glm::translate(view, vec3(0.0f, 0.0f, -200.0f));
@@ -416,38 +595,96 @@ int main(int argc, char* argv[])
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
     // Draw grid
-    glBindTexture(GL_TEXTURE_2D, texture_grid);
-    glBindVertexArray(grid_vao);
-    glUseProgram(grid_shader.id);
-    grid_shader.SetMatrix4fv("model", mat4(1.0f));
-    grid_shader.SetMatrix4fv("view", view);
-    grid_shader.SetMatrix4fv("projection", projection);
-    glDrawArrays(GL_TRIANGLES, 0, 6);
-
-    // Draw birds
-    glBindVertexArray(triangle_vao);
+    {
+      PROFILE_ZONE("draw grid");
+      grid_pass_timer.Begin();
+      glBindTexture(GL_TEXTURE_2D, texture_grid);
+      glBindVertexArray(grid_vao);
+      glUseProgram(grid_shader.id);
+      grid_shader.SetMatrix4fv("model", mat4(1.0f));
+      grid_shader.SetMatrix4fv("view", view);
+      grid_shader.SetMatrix4fv("projection", projection);
+      glDrawArrays(GL_TRIANGLES, 0, 6);
+      grid_pass_timer.End();
+    }
+
+    // Draw birds. The newest render slot is acquired before the pass starts, so waiting for it isn't timed as part of
+    // the pass. Without render slots the pass includes uploading the birds.
+    if (use_render_slots) {
+      PROFILE_ZONE("acquire render slot");
+      render_slots.AcquireNewest();
+    }
+    bird_pass_timer.Begin();
     glUseProgram(bird_shader.id);
     bird_shader.SetMatrix4fv("view", view);
     bird_shader.SetMatrix4fv("projection", projection);
 
-    for (int i = 0; i < state.num_of_flocks; ++i) {
-      bird_shader.Set3fv("color", flock_colors[i]);
-      int start = state.flock_ranges[i * 2];
-      int end = state.flock_ranges[i * 2 + 1];
-      for (int j = start; j < end; ++j)
-      {
-        DrawBird(state.birds[j], bird_shader);
+    // With a fixed timestep, draw one tick behind and interpolate between the last two simulated states
+    float alpha = 1.0f;
+    if (use_render_slots) {
+      // The birds are already in the newest render slot, nothing to upload
+      BirdRenderSlots::Slot& slot = render_slots.ReadSlot();
+      if (fixed_timestep) {
+        alpha = InterpolationAlpha(slot.simulated_time, slot.prev_simulated_time, slot.publish_clock_time);
       }
+      glBindVertexArray(render_slots.ReadVertexArray());
+    }
+    else {
+      // The newest whole tick, the snapshot drawn last frame if none was published since
+      snapshots.AcquireNewest();
+      const BirdSnapshots::Snapshot& snapshot = snapshots.ReadSnapshot();
+      if (fixed_timestep) {
+        alpha = InterpolationAlpha(snapshot.simulated_time, snapshot.prev_simulated_time, snapshot.publish_clock_time);
+      }
+      glBindVertexArray(triangle_vao);
+
+      // Upload the birds, orphaning the buffers so the upload doesn't wait for the previous frame's draw.
+      // The previous tick is only needed while interpolating.
+      PROFILE_ZONE("upload birds");
+      const vec4* snapshot_data[4] = { snapshot.pos, snapshot.dir, snapshot.prev_pos, snapshot.prev_dir };
+      int num_of_instance_uploads = alpha < 1.0f ? 4 : 2;
+      for (int i = 0; i < num_of_instance_uploads; ++i) {
+        glBindBuffer(GL_ARRAY_BUFFER, bird_instance_vbos[i]);
+        glBufferData(GL_ARRAY_BUFFER, bird_instance_data_size, NULL, GL_STREAM_DRAW);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, bird_instance_data_size, snapshot_data[i]);
+      }
+    }
+    {
+      PROFILE_ZONE("draw birds");
+      bird_shader.Set1f("alpha", alpha);
+      glDrawArraysInstanced(GL_TRIANGLES, 0, 3, state.num_of_birds);
+      if (use_render_slots) {
+        render_slots.FenceDraw();
+      }
+      bird_pass_timer.End();
+    }
+    {
+      PROFILE_ZONE("swap buffers");
+      glfwSwapBuffers(window);
+    }
+    {
+      PROFILE_ZONE("poll events");
+      glfwPollEvents();
     }
-    glfwSwapBuffers(window);
-
-    glfwPollEvents();
 
     update_count += 1;
     if (draw_time - time_of_last_title_update >= 1.0f) {
       final_fps = update_count;
       stringstream ss;
       ss << "Bird Flock Simulation" << " Sim/s: " << final_ticks << " Avg/s: " << final_flock_avgs_ticks << " Draws/s: " << final_fps;
+      ss << " Missed Sim: " << sim_scheduler.missed_deadlines << " Draw: " << draw_scheduler.missed_deadlines;
+      if (backend->SeparateFlockAverages()) {
+        ss << " Avg: " << avgs_scheduler.missed_deadlines;
+      }
+      if (fixed_timestep) {
+        ss << " Dropped steps: " << dropped_steps;
+      }
+      GpuPassTimer::Means grid_pass = grid_pass_timer.TakeMeans();
+      GpuPassTimer::Means bird_pass = bird_pass_timer.TakeMeans();
+      ss << std::fixed << std::setprecision(2) << " Grid ms CPU: " << grid_pass.cpu_ms << " GPU: " << grid_pass.gpu_ms
+        << " Birds ms CPU: " << bird_pass.cpu_ms << " GPU: " << bird_pass.gpu_ms << std::defaultfloat;
+      ss << " " << backend->Name();
+      ss << (gl_sharing ? " GL sharing" : persistent_mapping ? " Persistent mapping" : " Host copy");
       glfwSetWindowTitle(window, ss.str().c_str());
       update_count = 0;
       time_of_last_title_update = draw_time;
@@ -456,19 +693,15 @@ int main(int argc, char* argv[])
 
   sim_running = false;
   sim_thread.join();
-  avgs_thread.join();
-
-  clReleaseMemObject(birds_buffer_gpu);
-  clReleaseMemObject(birds_buffer_cpu);
-  clReleaseMemObject(bird_to_flock_buffer);
-  clReleaseMemObject(flock_avgs_buffer_gpu);
-  clReleaseMemObject(flock_avgs_buffer_cpu);
-  clReleaseMemObject(flock_ranges_buffer_gpu);
-  clReleaseMemObject(flock_ranges_buffer_cpu);
-  clReleaseMemObject(time_input_buffer);
-  delete[] platform_ids;
-  clReleaseContext(gpu_context);
-  clReleaseKernel(simulate_bird_kernel);
-  clReleaseProgram(program_gpu);
-  clReleaseCommandQueue(queue_gpu);
+  if (avgs_thread.joinable()) {
+    avgs_thread.join();
+  }
+
+  backend->Shutdown();
+  if (use_render_slots) {
+    render_slots.Release();
+  }
+  grid_pass_timer.Release();
+  bird_pass_timer.Release();
+  write_trace();
 }
@@ -0,0 +1,59 @@
+#include "native_backend.h"
+#include <cstring>
+#include "zone_profiler.h"
+
+bool NativeBackend::Init(SimulationState& state) {
+  this->state = &state;
+  simulation.Init(state, simd_level);
+  return true;
+}
+
+bool NativeBackend::AttachRenderSlots(BirdRenderTargets& render_slots) {
+  // The birds can only be copied into mapped buffers
+  if (render_slots.slots[0].mapped[0] == nullptr) {
+    return false;
+  }
+  this->render_slots = &render_slots;
+  return true;
+}
+
+void NativeBackend::Step(float delta_time) {
+  simulation.stage_timings = stage_timings;
+  simulation.Step(delta_time);
+}
+
+void NativeBackend::Fetch(double simulated_time, double prev_simulated_time) {
+  PROFILE_ZONE("copy birds");
+  size_t bird_vectors_size = sizeof(vec4) * state->num_of_birds;
+  vec4* sources[4] = { simulation.Pos(), simulation.Dir(), simulation.PrevPos(), simulation.PrevDir() };
+  // The previous step is only needed while interpolating
+  int num_of_sources = prev_simulated_time < simulated_time ? 4 : 2;
+  if (render_slots != nullptr) {
+    BirdRenderTargets::Slot& slot = render_slots->WriteSlot();
+    for (int i = 0; i < num_of_sources; ++i) {
+      std::memcpy(slot.mapped[i], sources[i], bird_vectors_size);
+    }
+    slot.simulated_time = simulated_time;
+    slot.prev_simulated_time = prev_simulated_time;
+    render_slots->Publish();
+  }
+  else if (snapshots != nullptr) {
+    BirdSnapshots::Snapshot& snapshot = snapshots->WriteSnapshot();
+    vec4* destinations[4] = { snapshot.pos, snapshot.dir, snapshot.prev_pos, snapshot.prev_dir };
+    for (int i = 0; i < num_of_sources; ++i) {
+      std::memcpy(destinations[i], sources[i], bird_vectors_size);
+    }
+    snapshot.simulated_time = simulated_time;
+    snapshot.prev_simulated_time = prev_simulated_time;
+    snapshots->Publish();
+  }
+  else {
+    vec4* destinations[4] = { state->bird_pos, state->bird_dir, state->prev_bird_pos, state->prev_bird_dir };
+    for (int i = 0; i < num_of_sources; ++i) {
+      std::memcpy(destinations[i], sources[i], bird_vectors_size);
+    }
+    state->prev_committed_time = prev_simulated_time;
+    state->committed_time = simulated_time;
+    state->commit_clock_time = TickScheduler::clock::now();
+  }
+}
@@ -0,0 +1,24 @@
+#pragma once
+#include "simulation_backend.h"
+#include "native_simulation.h"
+
+// Simulation on the host with NativeSimulation. Steps run synchronously on the TBB worker threads,
+// so every tick is complete by the time it is fetched.
+struct NativeBackend : SimulationBackend {
+  // Set before Init
+  SimdLevel simd_level = SimdLevel::Scalar;
+
+  NativeSimulation simulation;
+
+  std::string Name() const override { return std::string("Native ") + SimdLevelName(simulation.simd_level); }
+  bool Init(SimulationState& state) override;
+  bool AttachRenderSlots(BirdRenderTargets& render_slots) override;
+  void Step(float delta_time) override;
+  void Fetch(double simulated_time, double prev_simulated_time) override;
+  void Commit(bool) override {}
+  void Shutdown() override {}
+
+private:
+  SimulationState* state = nullptr;
+  BirdRenderTargets* render_slots = nullptr;
+};
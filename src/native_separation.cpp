@@ -0,0 +1,242 @@
+#include "native_separation.h"
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+#if defined(_M_X64) || defined(__x86_64__) || defined(_M_IX86) || defined(__i386__)
+#define SIMD_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+// MSVC allows any instruction set's intrinsics in any function
+#define SIMD_TARGET(isa)
+#else
+#include <cpuid.h>
+// GCC and Clang only allow intrinsics in functions compiled for their instruction set
+#define SIMD_TARGET(isa) __attribute__((target(isa)))
+#endif
+#endif
+
+using glm::vec3;
+
+namespace {
+
+vec3 SeparationScalarRun(const float* x, const float* y, const float* z, uint32_t begin, uint32_t end, vec3 pos, float separation_dist) {
+  vec3 sum = vec3(0.0f);
+  for (uint32_t i = begin; i < end; ++i) {
+    vec3 delta = vec3(x[i], y[i], z[i]) - pos;
+    float distance = glm::length(delta);
+    if (distance > 0.0f && distance < separation_dist) {
+      sum += delta * ((separation_dist - distance) / distance);
+    }
+  }
+  return sum;
+}
+
+// Reference version, the same math as simulate_bird_grid
+vec3 SeparationScalar(const float* x, const float* y, const float* z, const SlotRuns& runs, vec3 pos, float separation_dist) {
+  vec3 sum = vec3(0.0f);
+  for (int run = 0; run < runs.count; ++run) {
+    sum += SeparationScalarRun(x, y, z, runs.begin[run], runs.end[run], pos, separation_dist);
+  }
+  return sum;
+}
+
+#if defined(SIMD_X86)
+
+// The SIMD versions use the approximate reciprocal square root refined by one Newton-Raphson step,
+// r = r * (1.5 - 0.5 * d2 * r * r), which is accurate to about 23 bits. Then distance = d2 * r and
+// delta / distance = delta * r, so the loop has no square root or division.
+
+SIMD_TARGET("sse2")
+vec3 SeparationSSE(const float* x, const float* y, const float* z, const SlotRuns& runs, vec3 pos, float separation_dist) {
+  const __m128 px = _mm_set1_ps(pos.x), py = _mm_set1_ps(pos.y), pz = _mm_set1_ps(pos.z);
+  const __m128 sep = _mm_set1_ps(separation_dist), sep2 = _mm_set1_ps(separation_dist * separation_dist);
+  const __m128 zero = _mm_setzero_ps(), half = _mm_set1_ps(0.5f), three_halves = _mm_set1_ps(1.5f);
+  __m128 sx = zero, sy = zero, sz = zero;
+  vec3 sum = vec3(0.0f);
+  for (int run = 0; run < runs.count; ++run) {
+    uint32_t i = runs.begin[run];
+    uint32_t end = runs.end[run];
+    for (; i + 4 <= end; i += 4) {
+      __m128 dx = _mm_sub_ps(_mm_loadu_ps(x + i), px);
+      __m128 dy = _mm_sub_ps(_mm_loadu_ps(y + i), py);
+      __m128 dz = _mm_sub_ps(_mm_loadu_ps(z + i), pz);
+      __m128 d2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+      __m128 in_range = _mm_and_ps(_mm_cmplt_ps(d2, sep2), _mm_cmpgt_ps(d2, zero));
+      __m128 r = _mm_rsqrt_ps(d2);
+      r = _mm_mul_ps(r, _mm_sub_ps(three_halves, _mm_mul_ps(_mm_mul_ps(half, d2), _mm_mul_ps(r, r))));
+      __m128 w = _mm_and_ps(_mm_mul_ps(_mm_sub_ps(sep, _mm_mul_ps(d2, r)), r), in_range);
+      sx = _mm_add_ps(sx, _mm_mul_ps(w, dx));
+      sy = _mm_add_ps(sy, _mm_mul_ps(w, dy));
+      sz = _mm_add_ps(sz, _mm_mul_ps(w, dz));
+    }
+    // Fewer than 4 birds left in the run
+    sum += SeparationScalarRun(x, y, z, i, end, pos, separation_dist);
+  }
+  alignas(16) float lanes[3][4];
+  _mm_store_ps(lanes[0], sx);
+  _mm_store_ps(lanes[1], sy);
+  _mm_store_ps(lanes[2], sz);
+  for (int lane = 0; lane < 4; ++lane) {
+    sum += vec3(lanes[0][lane], lanes[1][lane], lanes[2][lane]);
+  }
+  return sum;
+}
+
+SIMD_TARGET("avx2,fma")
+vec3 SeparationAVX2(const float* x, const float* y, const float* z, const SlotRuns& runs, vec3 pos, float separation_dist) {
+  const __m256 px = _mm256_set1_ps(pos.x), py = _mm256_set1_ps(pos.y), pz = _mm256_set1_ps(pos.z);
+  const __m256 sep = _mm256_set1_ps(separation_dist), sep2 = _mm256_set1_ps(separation_dist * separation_dist);
+  const __m256 zero = _mm256_setzero_ps(), half = _mm256_set1_ps(0.5f), three_halves = _mm256_set1_ps(1.5f);
+  const __m256i lane_index = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+  __m256 sx = zero, sy = zero, sz = zero;
+  for (int run = 0; run < runs.count; ++run) {
+    uint32_t end = runs.end[run];
+    for (uint32_t i = runs.begin[run]; i < end; i += 8) {
+      // The last iteration loads only the remaining birds, the other lanes are masked out
+      __m256i valid = _mm256_cmpgt_epi32(_mm256_set1_epi32((int)(end - i)), lane_index);
+      __m256 dx = _mm256_sub_ps(_mm256_maskload_ps(x + i, valid), px);
+      __m256 dy = _mm256_sub_ps(_mm256_maskload_ps(y + i, valid), py);
+      __m256 dz = _mm256_sub_ps(_mm256_maskload_ps(z + i, valid), pz);
+      __m256 d2 = _mm256_fmadd_ps(dz, dz, _mm256_fmadd_ps(dy, dy, _mm256_mul_ps(dx, dx)));
+      __m256 in_range = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(d2, sep2, _CMP_LT_OQ), _mm256_cmp_ps(d2, zero, _CMP_GT_OQ)), _mm256_castsi256_ps(valid));
+      __m256 r = _mm256_rsqrt_ps(d2);
+      r = _mm256_mul_ps(r, _mm256_fnmadd_ps(_mm256_mul_ps(half, d2), _mm256_mul_ps(r, r), three_halves));
+      __m256 w = _mm256_and_ps(_mm256_mul_ps(_mm256_fnmadd_ps(d2, r, sep), r), in_range);
+      sx = _mm256_fmadd_ps(w, dx, sx);
+      sy = _mm256_fmadd_ps(w, dy, sy);
+      sz = _mm256_fmadd_ps(w, dz, sz);
+    }
+  }
+  alignas(32) float lanes[3][8];
+  _mm256_store_ps(lanes[0], sx);
+  _mm256_store_ps(lanes[1], sy);
+  _mm256_store_ps(lanes[2], sz);
+  vec3 sum = vec3(0.0f);
+  for (int lane = 0; lane < 8; ++lane) {
+    sum += vec3(lanes[0][lane], lanes[1][lane], lanes[2][lane]);
+  }
+  return sum;
+}
+
+SIMD_TARGET("avx512f")
+vec3 SeparationAVX512(const float* x, const float* y, const float* z, const SlotRuns& runs, vec3 pos, float separation_dist) {
+  const __m512 px = _mm512_set1_ps(pos.x), py = _mm512_set1_ps(pos.y), pz = _mm512_set1_ps(pos.z);
+  const __m512 sep = _mm512_set1_ps(separation_dist), sep2 = _mm512_set1_ps(separation_dist * separation_dist);
+  const __m512 zero = _mm512_setzero_ps(), half = _mm512_set1_ps(0.5f), three_halves = _mm512_set1_ps(1.5f);
+  __m512 sx = zero, sy = zero, sz = zero;
+  for (int run = 0; run < runs.count; ++run) {
+    uint32_t end = runs.end[run];
+    for (uint32_t i = runs.begin[run]; i < end; i += 16) {
+      // The last iteration loads only the remaining birds, the other lanes are masked out
+      __mmask16 valid = end - i >= 16 ? (__mmask16)0xFFFF : (__mmask16)((1u << (end - i)) - 1);
+      __m512 dx = _mm512_sub_ps(_mm512_maskz_loadu_ps(valid, x + i), px);
+      __m512 dy = _mm512_sub_ps(_mm512_maskz_loadu_ps(valid, y + i), py);
+      __m512 dz = _mm512_sub_ps(_mm512_maskz_loadu_ps(valid, z + i), pz);
+      __m512 d2 = _mm512_fmadd_ps(dz, dz, _mm512_fmadd_ps(dy, dy, _mm512_mul_ps(dx, dx)));
+      __mmask16 in_range = valid & _mm512_cmp_ps_mask(d2, sep2, _CMP_LT_OQ) & _mm512_cmp_ps_mask(d2, zero, _CMP_GT_OQ);
+      __m512 r = _mm512_rsqrt14_ps(d2);
+      r = _mm512_mul_ps(r, _mm512_fnmadd_ps(_mm512_mul_ps(half, d2), _mm512_mul_ps(r, r), three_halves));
+      __m512 w = _mm512_maskz_mul_ps(in_range, _mm512_fnmadd_ps(d2, r, sep), r);
+      sx = _mm512_fmadd_ps(w, dx, sx);
+      sy = _mm512_fmadd_ps(w, dy, sy);
+      sz = _mm512_fmadd_ps(w, dz, sz);
+    }
+  }
+  return vec3(_mm512_reduce_add_ps(sx), _mm512_reduce_add_ps(sy), _mm512_reduce_add_ps(sz));
+}
+
+void CpuId(int leaf, int subleaf, unsigned int registers[4]) {
+#if defined(_MSC_VER)
+  int values[4];
+  __cpuidex(values, leaf, subleaf);
+  std::memcpy(registers, values, sizeof(values));
+#else
+  __cpuid_count(leaf, subleaf, registers[0], registers[1], registers[2], registers[3]);
+#endif
+}
+
+// Register state the OS saves on context switches, bit 1 SSE, 2 AVX, 5-7 AVX-512
+unsigned long long XGetBV() {
+#if defined(_MSC_VER)
+  return _xgetbv(0);
+#else
+  unsigned int eax, edx;
+  __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+  return ((unsigned long long)edx << 32) | eax;
+#endif
+}
+
+#endif
+
+}
+
+SimdLevel DetectSimdLevel() {
+#if defined(SIMD_X86)
+  unsigned int leaf0[4], leaf1[4], leaf7[4] = {};
+  CpuId(0, 0, leaf0);
+  CpuId(1, 0, leaf1);
+  if (leaf0[0] >= 7) {
+    CpuId(7, 0, leaf7);
+  }
+  bool osxsave = (leaf1[2] & (1u << 27)) != 0;
+  unsigned long long os_state = osxsave ? XGetBV() : 0;
+  bool avx_state = (os_state & 0x6) == 0x6;
+  bool avx512_state = (os_state & 0xE6) == 0xE6;
+  bool fma = (leaf1[2] & (1u << 12)) != 0;
+  bool avx2 = (leaf7[1] & (1u << 5)) != 0;
+  bool avx512f = (leaf7[1] & (1u << 16)) != 0;
+  if (avx512f && avx512_state) {
+    return SimdLevel::AVX512;
+  }
+  if (avx2 && fma && avx_state) {
+    return SimdLevel::AVX2;
+  }
+  return SimdLevel::SSE;
+#else
+  return SimdLevel::Scalar;
+#endif
+}
+
+bool ParseSimdLevel(const char* name, SimdLevel& level) {
+  SimdLevel requested;
+  if (std::strcmp(name, "scalar") == 0) {
+    requested = SimdLevel::Scalar;
+  }
+  else if (std::strcmp(name, "sse") == 0) {
+    requested = SimdLevel::SSE;
+  }
+  else if (std::strcmp(name, "avx2") == 0) {
+    requested = SimdLevel::AVX2;
+  }
+  else if (std::strcmp(name, "avx512") == 0) {
+    requested = SimdLevel::AVX512;
+  }
+  else {
+    return false;
+  }
+  level = std::min(requested, DetectSimdLevel());
+  return true;
+}
+
+const char* SimdLevelName(SimdLevel level) {
+  switch (level) {
+    case SimdLevel::SSE: return "SSE";
+    case SimdLevel::AVX2: return "AVX2";
+    case SimdLevel::AVX512: return "AVX-512";
+    default: return "scalar";
+  }
+}
+
+SeparationFunction SelectSeparationFunction(SimdLevel level) {
+#if defined(SIMD_X86)
+  switch (level) {
+    case SimdLevel::SSE: return SeparationSSE;
+    case SimdLevel::AVX2: return SeparationAVX2;
+    case SimdLevel::AVX512: return SeparationAVX512;
+    default: break;
+  }
+#endif
+  return SeparationScalar;
+}
@@ -0,0 +1,26 @@
+#pragma once
+#include <cstdint>
+#include <glm.hpp>
+
+// Runs of neighbour slots in structure of arrays positions, begin[i] to end[i] (exclusive)
+struct SlotRuns {
+  static const int max_runs = 9;
+  uint32_t begin[max_runs];
+  uint32_t end[max_runs];
+  int count = 0;
+};
+
+// Separation sum of a bird at pos over the birds in the slot runs: the sum of
+// delta * (separation_dist - distance) / distance over the birds closer than separation_dist, with delta
+// the vector from pos to the other bird. Birds at distance 0 (the bird itself) are skipped.
+// The separation force is minus this sum times the separation force coefficient.
+using SeparationFunction = glm::vec3 (*)(const float* x, const float* y, const float* z, const SlotRuns& runs, glm::vec3 pos, float separation_dist);
+
+enum class SimdLevel { Scalar, SSE, AVX2, AVX512 };
+
+// Widest level the CPU and OS support, from CPUID and XGETBV
+SimdLevel DetectSimdLevel();
+// Level from a --simd argument (scalar, sse, avx2, avx512), capped at what the CPU supports. False if the name is none of them.
+bool ParseSimdLevel(const char* name, SimdLevel& level);
+const char* SimdLevelName(SimdLevel level);
+SeparationFunction SelectSeparationFunction(SimdLevel level);
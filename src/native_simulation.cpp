@@ -0,0 +1,217 @@
+#include "native_simulation.h"
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_reduce.h>
+#include <tbb/blocked_range.h>
+#include "zone_profiler.h"
+
+using glm::ivec3;
+
+namespace {
+
+// Direction and position sums of a range of birds
+struct FlockSums {
+  vec4 dir{ 0,0,0,0 };
+  vec4 pos{ 0,0,0,0 };
+};
+
+}
+
+void NativeSimulation::Init(SimulationState& simulation_state, SimdLevel level) {
+  state = &simulation_state;
+  simd_level = level;
+  separation = SelectSeparationFunction(simd_level);
+  size_t bird_vectors_size = sizeof(vec4) * state->num_of_birds;
+  for (int i = 0; i < 2; ++i) {
+    pos[i].Allocate(state->num_of_birds);
+    dir[i].Allocate(state->num_of_birds);
+    std::memcpy(pos[i], state->bird_pos, bird_vectors_size);
+    std::memcpy(dir[i], state->bird_dir, bird_vectors_size);
+  }
+  current = 0;
+
+  cell_size = state->separation_dist;
+  grid_origin = vec3(SimulationState::world_size_x_start, SimulationState::world_size_y_start, SimulationState::world_size_z_start) - SimulationState::grid_margin;
+  grid_dims.x = (int)std::ceil((SimulationState::world_size_x_end - SimulationState::world_size_x_start + 2 * SimulationState::grid_margin) / cell_size);
+  grid_dims.y = (int)std::ceil((SimulationState::world_size_y_end - SimulationState::world_size_y_start + 2 * SimulationState::grid_margin) / cell_size);
+  grid_dims.z = (int)std::ceil((SimulationState::world_size_z_end - SimulationState::world_size_z_start + 2 * SimulationState::grid_margin) / cell_size);
+  cells_per_flock = (size_t)grid_dims.x * grid_dims.y * grid_dims.z;
+
+  bird_cells.resize(state->num_of_birds);
+  cell_counts.resize(cells_per_flock * state->num_of_flocks);
+  cell_starts.resize(cells_per_flock * state->num_of_flocks);
+  sorted_x.Allocate(state->num_of_birds);
+  sorted_y.Allocate(state->num_of_birds);
+  sorted_z.Allocate(state->num_of_birds);
+}
+
+ivec3 NativeSimulation::CellCoords(vec3 bird_pos) const {
+  ivec3 coords = ivec3(glm::floor((bird_pos - grid_origin) / cell_size));
+  return glm::clamp(coords, ivec3(0), grid_dims - 1);
+}
+
+size_t NativeSimulation::CellIndex(int flock, ivec3 coords) const {
+  return flock * cells_per_flock + ((size_t)coords.z * grid_dims.y + coords.y) * grid_dims.x + coords.x;
+}
+
+// Same as sum_flock_blocks + combine_flock_sums
+void NativeSimulation::UpdateFlockAverages() {
+  const vec4* pos_in = pos[current];
+  const vec4* dir_in = dir[current];
+  for (int flock = 0; flock < state->num_of_flocks; ++flock) {
+    cl_uint flock_start = state->flock_ranges[flock * 2];
+    cl_uint flock_end = state->flock_ranges[flock * 2 + 1];
+    FlockSums sums = tbb::parallel_reduce(tbb::blocked_range<cl_uint>(flock_start, flock_end), FlockSums(),
+      [&](const tbb::blocked_range<cl_uint>& range, FlockSums partial) {
+        for (cl_uint i = range.begin(); i != range.end(); ++i) {
+          partial.dir += dir_in[i];
+          partial.pos += pos_in[i];
+        }
+        return partial;
+      },
+      [](FlockSums a, const FlockSums& b) {
+        a.dir += b.dir;
+        a.pos += b.pos;
+        return a;
+      });
+    float num_of_birds = (float)(flock_end - flock_start);
+    state->flocks[flock].avgdir = vec4(glm::normalize(vec3(sums.dir) / num_of_birds), 0.0f);
+    state->flocks[flock].avgpos = vec4(vec3(sums.pos) / num_of_birds, 0.0f);
+  }
+}
+
+// Same as count_grid_cells + scan_grid_cells + scatter_grid_birds, one flock per task
+void NativeSimulation::BuildGrid() {
+  const vec4* pos_in = pos[current];
+  tbb::parallel_for(0, state->num_of_flocks, [&](int flock) {
+    cl_uint flock_start = state->flock_ranges[flock * 2];
+    cl_uint flock_end = state->flock_ranges[flock * 2 + 1];
+    cl_uint* counts = &cell_counts[flock * cells_per_flock];
+    cl_uint* starts = &cell_starts[flock * cells_per_flock];
+    std::fill(counts, counts + cells_per_flock, 0);
+    for (cl_uint i = flock_start; i < flock_end; ++i) {
+      size_t cell = CellIndex(flock, CellCoords(vec3(pos_in[i])));
+      bird_cells[i] = (cl_uint)cell;
+      counts[cell - flock * cells_per_flock] += 1;
+    }
+    cl_uint start = flock_start;
+    for (size_t cell = 0; cell < cells_per_flock; ++cell) {
+      starts[cell] = start;
+      start += counts[cell];
+      counts[cell] = 0;
+    }
+    // The counts are rebuilt while scattering, so they end up the same as before
+    for (cl_uint i = flock_start; i < flock_end; ++i) {
+      size_t cell = bird_cells[i] - flock * cells_per_flock;
+      cl_uint slot = starts[cell] + counts[cell]++;
+      sorted_x[slot] = pos_in[i].x;
+      sorted_y[slot] = pos_in[i].y;
+      sorted_z[slot] = pos_in[i].z;
+    }
+  });
+}
+
+void NativeSimulation::Step(float delta_time) {
+  StageTimings::clock::time_point stage_start = StageTimings::clock::now();
+  // Stages are timed for the stage timings and the zone profiler's timeline alike
+  auto end_stage = [&](const char* name) {
+    bool record_zone = zone_profiler_enabled.load(std::memory_order_relaxed);
+    if (stage_timings != nullptr || record_zone) {
+      StageTimings::clock::time_point now = StageTimings::clock::now();
+      if (stage_timings != nullptr) {
+        stage_timings->Add(name, std::chrono::duration<double>(now - stage_start).count());
+      }
+      if (record_zone) {
+        RecordZone(name, stage_start, now);
+      }
+      stage_start = now;
+    }
+  };
+
+  UpdateFlockAverages();
+  end_stage("step: flock averages");
+  BuildGrid();
+  end_stage("step: grid");
+
+  const vec4* pos_in = pos[current];
+  const vec4* dir_in = dir[current];
+  vec4* pos_out = pos[1 - current];
+  vec4* dir_out = dir[1 - current];
+  const float separation_dist = state->separation_dist;
+  const float separation_force = state->separation_force_coefficient;
+  const float alignment = state->flock_alignment_coefficient;
+  const float cohesion = state->flock_cohesion_coefficient;
+  const float turn = state->bird_rot_speed * delta_time;
+  const float cos_turn = std::cos(turn);
+  const float sin_turn = std::sin(turn);
+  const float distance_moved = state->bird_mov_speed * delta_time;
+
+  // Same as simulate_bird_grid + update_bird
+  tbb::parallel_for(tbb::blocked_range<int>(0, state->num_of_birds), [&](const tbb::blocked_range<int>& range) {
+    for (int gid = range.begin(); gid != range.end(); ++gid) {
+      int flock = state->bird_to_flock[gid];
+      vec3 pos_a = vec3(pos_in[gid]);
+      ivec3 cell = CellCoords(pos_a);
+
+      // Separation from the birds in the neighbouring cells. Cells are ordered by x first, so the three
+      // cells of each row are one contiguous run of sorted slots.
+      int x_first = std::max(cell.x - 1, 0);
+      int x_last = std::min(cell.x + 1, grid_dims.x - 1);
+      SlotRuns runs;
+      for (int dz = -1; dz <= 1; ++dz) {
+        for (int dy = -1; dy <= 1; ++dy) {
+          int y = cell.y + dy;
+          int z = cell.z + dz;
+          if (y < 0 || y >= grid_dims.y || z < 0 || z >= grid_dims.z) {
+            continue;
+          }
+          size_t first_cell = CellIndex(flock, ivec3(x_first, y, z));
+          size_t last_cell = CellIndex(flock, ivec3(x_last, y, z));
+          runs.begin[runs.count] = cell_starts[first_cell];
+          runs.end[runs.count] = cell_starts[last_cell] + cell_counts[last_cell];
+          ++runs.count;
+        }
+      }
+      vec3 force = -separation(sorted_x, sorted_y, sorted_z, runs, pos_a, separation_dist) * separation_force;
+
+      // Flock alignment and cohesion
+      force += vec3(state->flocks[flock].avgdir) * alignment;
+      force += glm::normalize(vec3(state->flocks[flock].avgpos) - pos_a) * cohesion;
+
+      // If out of world bounds, make birds turn around
+      if (pos_a.x < SimulationState::world_size_x_start) {
+        force += vec3(1, 0, 0);
+      }
+      else if (pos_a.x > SimulationState::world_size_x_end) {
+        force += vec3(-1, 0, 0);
+      }
+      if (pos_a.y < SimulationState::world_size_y_start) {
+        force += vec3(0, 1, 0);
+      }
+      else if (pos_a.y > SimulationState::world_size_y_end) {
+        force += vec3(0, -1, 0);
+      }
+      if (pos_a.z < SimulationState::world_size_z_start) {
+        force += vec3(0, 0, 2);
+      }
+      else if (pos_a.z > SimulationState::world_size_z_end) {
+        force += vec3(0, 0, -1);
+      }
+
+      // Rotate and move bird
+      vec3 dir_a = vec3(dir_in[gid]);
+      force = glm::normalize(force);
+      vec3 ninety = glm::normalize(glm::cross(glm::cross(dir_a, force), dir_a));
+      dir_a = cos_turn * dir_a + sin_turn * ninety;
+      pos_a += dir_a * distance_moved;
+
+      pos_out[gid] = vec4(pos_a, 0.0f);
+      dir_out[gid] = vec4(dir_a, 0.0f);
+    }
+  });
+  end_stage("step: birds");
+
+  current = 1 - current;
+}
@@ -0,0 +1,54 @@
+#pragma once
+#include <vector>
+#include "simulation_state.h"
+#include "aligned_array.h"
+#include "native_separation.h"
+#include "stage_timings.h"
+
+// The simulation step of the OpenCL path (flock averages, then simulate_bird_grid) in native C++,
+// parallelised over birds with TBB. It needs no OpenCL runtime, and gives a baseline to compare the
+// OpenCL devices against. The flock averages are written to state.flocks.
+// The separation loop runs on SIMD kernels over the sorted positions, see native_separation.h.
+struct NativeSimulation {
+  SimulationState* state = nullptr;
+
+  // Birds are double buffered like on the device, each step reads pos/dir[current] and writes the other pair
+  AlignedArray<vec4> pos[2];
+  AlignedArray<vec4> dir[2];
+  int current = 0;
+
+  // Uniform grid with one set of cells per flock, see SpatialGrid. Flocks are contiguous ranges of
+  // birds with disjoint cells, so each flock is sorted independently.
+  vec3 grid_origin{};
+  glm::ivec3 grid_dims{};
+  float cell_size = 1.0f;
+  size_t cells_per_flock = 0;
+  std::vector<cl_uint> bird_cells;
+  std::vector<cl_uint> cell_counts;
+  std::vector<cl_uint> cell_starts;
+  // Positions ordered by cell as a structure of arrays, so the separation kernels load 8/16 neighbours at once
+  AlignedArray<float> sorted_x;
+  AlignedArray<float> sorted_y;
+  AlignedArray<float> sorted_z;
+
+  SimdLevel simd_level = SimdLevel::Scalar;
+  SeparationFunction separation = nullptr;
+
+  // When set, each step adds the time of its flock averages, grid and bird update stages
+  StageTimings* stage_timings = nullptr;
+
+  void Init(SimulationState& state, SimdLevel simd_level);
+  void Step(float delta_time);
+
+  // Birds after the last step, and before it
+  vec4* Pos() { return pos[current]; }
+  vec4* Dir() { return dir[current]; }
+  vec4* PrevPos() { return pos[1 - current]; }
+  vec4* PrevDir() { return dir[1 - current]; }
+
+private:
+  void UpdateFlockAverages();
+  void BuildGrid();
+  glm::ivec3 CellCoords(vec3 pos) const;
+  size_t CellIndex(int flock, glm::ivec3 coords) const;
+};
@@ -0,0 +1,512 @@
+#include "opencl_backend.h"
+#include <iostream>
+#include <cstring>
+#include <algorithm>
+#include <CL/cl_gl.h>
+#include "kernels.h"
+#include "cl_helpers.h"
+#include "zone_profiler.h"
+
+namespace {
+
+bool EventComplete(cl_event event) {
+  cl_int status;
+  clGetEventInfo(event, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(cl_int), &status, NULL);
+  return status == CL_COMPLETE;
+}
+
+}
+
+bool OpenCLBackend::Init(SimulationState& state) {
+  this->state = &state;
+  cl_float4* p_bird_pos = (cl_float4*)state.bird_pos.data;
+  cl_float4* p_bird_dir = (cl_float4*)state.bird_dir.data;
+  cl_float4* p_flock_avgs = (cl_float4*)state.flocks;
+  size_t bird_to_flock_buffer_size = sizeof(cl_uint) * state.max_birds;
+  size_t flock_ranges_buffer_size = sizeof(cl_uint) * 2 * state.max_flocks;
+  bird_vectors_buffer_size = sizeof(cl_float4) * state.max_birds;
+  flock_avgs_buffer_size = sizeof(cl_float4) * 2 * state.max_flocks;
+  cl_int err;
+
+  ProgramCache& cache = program_cache != nullptr ? *program_cache : own_program_cache;
+  string kernel_build_options = state.KernelBuildOptions();
+
+  // Score every device of every platform and pick the simulation (and flock averages) device
+  bool found_devices = devices.empty();
+  if (found_devices) {
+    devices = FindDevices(benchmark_devices);
+  }
+  assignment = AssignDevices(devices, requested_device, two_device_pipeline);
+  if (found_devices) {
+    PrintDevices(devices, assignment);
+  }
+  if (assignment.simulation < 0) {
+    std::cerr << "No usable OpenCL device" << std::endl;
+    return false;
+  }
+  if (two_device_pipeline && assignment.flock_averages < 0) {
+    std::cerr << "No second OpenCL device for the flock averages, computing them on the simulation device" << std::endl;
+    two_device_pipeline = false;
+  }
+  const DeviceCandidate& simulation_device = devices[assignment.simulation];
+  cl_device_id gpu_device = simulation_device.device;
+  const cl_context_properties properties[] = { CL_CONTEXT_PLATFORM, (cl_context_properties)simulation_device.platform, 0 };
+
+  // Share the context with OpenGL when possible, the context can still fail to be created if the device
+  // isn't the one driving the window, in which case the birds go through the host
+  if (!gl_share_properties.empty() && DeviceHasExtension(gpu_device, "cl_khr_gl_sharing")) {
+    std::vector<cl_context_properties> gl_properties = gl_share_properties;
+    gl_properties.insert(gl_properties.end(), std::begin(properties), std::end(properties)); // platform and terminating 0
+    gpu_context = clCreateContext(gl_properties.data(), 1, &gpu_device, NULL, NULL, &err);
+    gl_sharing = err == CL_SUCCESS;
+  }
+  if (!gl_sharing) {
+    gpu_context = clCreateContext(properties, 1, &gpu_device, NULL, NULL, &err);
+    if (!CheckCL(err, "clCreateContext")) {
+      return false;
+    }
+  }
+
+  // Setup GPU kernel
+  profiler_gpu.enabled = profile_commands;
+  profiler_gpu.queue_name = "simulation";
+  queue_gpu = clCreateCommandQueue(gpu_context, gpu_device, profile_commands ? CL_QUEUE_PROFILING_ENABLE : 0, &err);
+  if (!CheckCL(err, "clCreateCommandQueue")) {
+    return false;
+  }
+
+  const char* source[4] = { char_bird_functions, char_simulate_bird_tiled, char_spatial_grid, char_flock_avgs }; // array of pointers where each pointer points to a string
+  cl_uint count = 4; // size of the source array
+
+  // Create and build the program with all kernels, specialised for the simulation constants
+  program_gpu = cache.Build(gpu_context, gpu_device, source, count, kernel_build_options);
+  if (program_gpu == NULL) {
+    return false;
+  }
+
+  use_spatial_grid = state.LargestFlockSize() >= state.grid_min_flock_size;
+
+  // Create Kernels
+  simulate_bird_kernel = clCreateKernel(program_gpu, use_spatial_grid ? "simulate_bird_grid" : "simulate_bird_tiled", &err);
+  if (!CheckCL(err, "clCreateKernel")) {
+    return false;
+  }
+
+  // Setup Buffers
+  for (int i = 0; i < 2; ++i) {
+    pos_buffers_gpu[i] = clCreateBuffer(gpu_context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, bird_vectors_buffer_size, p_bird_pos, &err);
+    if (!CheckCL(err, "clCreateBuffer (positions)")) {
+      return false;
+    }
+    dir_buffers_gpu[i] = clCreateBuffer(gpu_context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, bird_vectors_buffer_size, p_bird_dir, &err);
+    if (!CheckCL(err, "clCreateBuffer (directions)")) {
+      return false;
+    }
+  }
+  bird_to_flock_buffer = clCreateBuffer(gpu_context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, bird_to_flock_buffer_size, state.bird_to_flock.data, &err);
+  if (!CheckCL(err, "clCreateBuffer (bird to flock)")) {
+    return false;
+  }
+  flock_avgs_buffer_gpu = clCreateBuffer(gpu_context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, flock_avgs_buffer_size, p_flock_avgs, &err);
+  if (!CheckCL(err, "clCreateBuffer (flock averages)")) {
+    return false;
+  }
+  flock_ranges_buffer_gpu = clCreateBuffer(gpu_context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, flock_ranges_buffer_size, state.flock_ranges, &err);
+  if (!CheckCL(err, "clCreateBuffer (flock ranges)")) {
+    return false;
+  }
+
+  // Set arguments
+  err = clSetKernelArg(simulate_bird_kernel, 4, sizeof(cl_mem), (void*)&bird_to_flock_buffer);
+  err = clSetKernelArg(simulate_bird_kernel, 5, sizeof(cl_mem), (void*)&flock_avgs_buffer_gpu);
+
+  gpu_work_dims[0] = state.num_of_birds;
+  if (use_spatial_grid) {
+    if (!grid.Init(gpu_context, gpu_device, program_gpu, state, bird_to_flock_buffer)) {
+      return false;
+    }
+    delta_time_arg = 6;
+    grid.SetSimulateArgs(simulate_bird_kernel, 7);
+  }
+  else {
+    // One tile of positions is loaded into local memory per work group
+    cl_uint num_of_birds = state.num_of_birds;
+    gpu_local_dims[0] = PowerOfTwoWorkGroupSize(simulate_bird_kernel, gpu_device, 256);
+    gpu_work_dims[0] = RoundUpWorkSize(num_of_birds, gpu_local_dims[0]);
+    p_gpu_local_dims = gpu_local_dims;
+    err = clSetKernelArg(simulate_bird_kernel, 6, sizeof(cl_mem), (void*)&flock_ranges_buffer_gpu);
+    delta_time_arg = 7;
+    err = clSetKernelArg(simulate_bird_kernel, 8, sizeof(cl_uint), (void*)&num_of_birds);
+    err = clSetKernelArg(simulate_bird_kernel, 9, sizeof(cl_float4) * gpu_local_dims[0], NULL);
+  }
+
+  if (!two_device_pipeline) {
+    // The reduction reads the simulation buffers directly, so averages never leave device memory
+    if (!flock_averages.Init(gpu_context, gpu_device, program_gpu, state, flock_ranges_buffer_gpu, flock_avgs_buffer_gpu)) {
+      return false;
+    }
+  }
+  else {
+    cl_device_id cpu_device = devices[assignment.flock_averages].device;
+    cpu_context = clCreateContext(NULL, 1, &cpu_device, NULL, NULL, &err);
+    if (!CheckCL(err, "clCreateContext (flock averages)")) {
+      return false;
+    }
+
+    // Setup CPU kernel
+    profiler_cpu.enabled = profile_commands;
+    profiler_cpu.queue_name = "flock averages";
+    queue_cpu = clCreateCommandQueue(cpu_context, cpu_device, profile_commands ? CL_QUEUE_PROFILING_ENABLE : 0, &err);
+    if (!CheckCL(err, "clCreateCommandQueue (flock averages)")) {
+      return false;
+    }
+
+    source[0] = { char_flock_avgs }; // array of pointers where each pointer points to a string
+    count = 1; // size of the source array
+
+    // Create and build the program with all kernels
+    program_cpu = cache.Build(cpu_context, cpu_device, source, count, kernel_build_options);
+    if (program_cpu == NULL) {
+      return false;
+    }
+
+    // Setup Buffers
+    pos_buffer_cpu = clCreateBuffer(cpu_context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, bird_vectors_buffer_size, p_bird_pos, &err);
+    dir_buffer_cpu = clCreateBuffer(cpu_context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, bird_vectors_buffer_size, p_bird_dir, &err);
+    flock_avgs_buffer_cpu = clCreateBuffer(cpu_context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, flock_avgs_buffer_size, p_flock_avgs, &err);
+    flock_ranges_buffer_cpu = clCreateBuffer(cpu_context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, flock_ranges_buffer_size, state.flock_ranges, &err);
+    if (pos_buffer_cpu == NULL || dir_buffer_cpu == NULL || flock_avgs_buffer_cpu == NULL || flock_ranges_buffer_cpu == NULL) {
+      CheckCL(err, "clCreateBuffer (flock averages)");
+      return false;
+    }
+
+    // Create Kernels and set arguments
+    if (!flock_averages.Init(cpu_context, cpu_device, program_cpu, state, flock_ranges_buffer_cpu, flock_avgs_buffer_cpu)) {
+      return false;
+    }
+  }
+
+  if (!cache.binary_directory.empty()) {
+    std::cout << "Kernel binaries reused: " << cache.binaries_reused << ", loaded from " << cache.binary_directory << ": " << cache.binaries_loaded << ", built and stored: " << cache.binaries_stored << std::endl;
+  }
+
+  for (TickInFlight& tick : ticks_in_flight) {
+    tick.pos.resize(state.num_of_birds);
+    tick.dir.resize(state.num_of_birds);
+    tick.flock_avgs.resize(state.max_flocks * 2);
+  }
+  if (two_device_pipeline) {
+    for (AveragesBirds& birds : averages_birds) {
+      birds.pos.resize(state.num_of_birds);
+      birds.dir.resize(state.num_of_birds);
+    }
+    // Uploaded until the averages thread publishes its first results
+    for (std::vector<cl_float4>& results : averages_results) {
+      results.assign(p_flock_avgs, p_flock_avgs + state.max_flocks * 2);
+    }
+  }
+  return true;
+}
+
+bool OpenCLBackend::AttachRenderSlots(BirdRenderTargets& render_slots) {
+  if (render_slots.slots[0].mapped[0] == nullptr) {
+    // With sharing, each tick's birds are copied on the device into the render slot's vertex buffers
+    if (!gl_sharing) {
+      return false;
+    }
+    cl_int err;
+    for (int slot = 0; slot < BirdRenderTargets::num_of_slots; ++slot) {
+      for (int i = 0; i < BirdRenderTargets::buffers_per_slot; ++i) {
+        render_slot_buffers[slot][i] = clCreateFromGLBuffer(gpu_context, CL_MEM_WRITE_ONLY, render_slots.slots[slot].buffers[i], &err);
+        gl_sharing = gl_sharing && err == CL_SUCCESS;
+      }
+    }
+    if (!gl_sharing) {
+      for (auto& slot_buffers : render_slot_buffers) {
+        for (cl_mem& buffer : slot_buffers) {
+          if (buffer != NULL) {
+            clReleaseMemObject(buffer);
+            buffer = NULL;
+          }
+        }
+      }
+      return false;
+    }
+  }
+  else {
+    // Otherwise the readback of each tick goes straight into the render slot's mapped buffers
+    gl_sharing = false;
+  }
+  this->render_slots = &render_slots;
+  return true;
+}
+
+void OpenCLBackend::CommitOldestTick() {
+  TickInFlight& tick = ticks_in_flight[oldest_tick_slot];
+  {
+    PROFILE_ZONE("wait for device");
+    clWaitForEvents(1, &tick.done_event);
+  }
+  clReleaseEvent(tick.done_event);
+  if (tick.read_back) {
+    PROFILE_ZONE("copy birds to state");
+    size_t bird_readback_size = sizeof(cl_float4) * state->num_of_birds;
+    if (tick.keep_prev) {
+      std::memcpy(state->prev_bird_pos, state->bird_pos, bird_readback_size);
+      std::memcpy(state->prev_bird_dir, state->bird_dir, bird_readback_size);
+    }
+    std::memcpy(state->bird_pos, tick.pos.data(), bird_readback_size);
+    std::memcpy(state->bird_dir, tick.dir.data(), bird_readback_size);
+    state->prev_committed_time = state->committed_time;
+    state->committed_time = tick.simulated_time;
+    state->commit_clock_time = TickScheduler::clock::now();
+  }
+  if (tick.filled_render_slot) {
+    render_slots->Publish();
+    render_slot_in_flight = false;
+  }
+  if (tick.filled_snapshot) {
+    snapshots->Publish();
+    snapshot_in_flight = false;
+  }
+  if (tick.filled_averages_birds) {
+    averages_birds_handoff.Publish();
+    averages_birds_in_flight = false;
+  }
+  oldest_tick_slot = (oldest_tick_slot + 1) % SimulationState::max_ticks_in_flight;
+  num_of_ticks_in_flight -= 1;
+}
+
+void OpenCLBackend::Commit(bool wait) {
+  while (num_of_ticks_in_flight > 0 && (wait || EventComplete(ticks_in_flight[oldest_tick_slot].done_event))) {
+    CommitOldestTick();
+  }
+  profiler_gpu.Collect();
+}
+
+void OpenCLBackend::Step(float delta_time) {
+  cl_int err;
+  if (!tick_open) {
+    // All slots are queued, wait for the oldest one before reusing its slot
+    if (num_of_ticks_in_flight == SimulationState::max_ticks_in_flight) {
+      StageTimings::clock::time_point start = StageTimings::clock::now();
+      CommitOldestTick();
+      if (stage_timings != nullptr) {
+        stage_timings->Add("step: wait for oldest tick", start);
+      }
+    }
+    if (two_device_pipeline) {
+      // The newest averages published by the averages thread, the ones uploaded last tick if there are none
+      if (averages_results_handoff.Acquire()) {
+        std::memcpy((void*)state->flocks, averages_results[averages_results_handoff.read_slot].data(), flock_avgs_buffer_size);
+      }
+      TickInFlight& tick = ticks_in_flight[next_tick_slot];
+      std::memcpy(tick.flock_avgs.data(), (const void*)state->flocks, flock_avgs_buffer_size);
+      err = clEnqueueWriteBuffer(queue_gpu, flock_avgs_buffer_gpu, CL_FALSE, 0, flock_avgs_buffer_size, tick.flock_avgs.data(), 0, NULL, &tick_wait_event);
+      profiler_gpu.Track("write: flock averages", tick_wait_event);
+    }
+    tick_open = true;
+  }
+
+  cl_mem pos_in = pos_buffers_gpu[current_buffer];
+  cl_mem dir_in = dir_buffers_gpu[current_buffer];
+  cl_mem pos_out = pos_buffers_gpu[1 - current_buffer];
+  cl_mem dir_out = dir_buffers_gpu[1 - current_buffer];
+
+  if (!two_device_pipeline) {
+    // Enqueued back to back with the simulation on the same queue, so the averages are always from the current step
+    flock_averages.Enqueue(queue_gpu, profiler_gpu, pos_in, dir_in);
+  }
+
+  // Sort birds into the grid cells
+  if (use_spatial_grid) {
+    grid.Build(queue_gpu, profiler_gpu, state->num_of_birds, pos_in);
+  }
+
+  err = clSetKernelArg(simulate_bird_kernel, 0, sizeof(cl_mem), (void*)&pos_in);
+  err = clSetKernelArg(simulate_bird_kernel, 1, sizeof(cl_mem), (void*)&dir_in);
+  err = clSetKernelArg(simulate_bird_kernel, 2, sizeof(cl_mem), (void*)&pos_out);
+  err = clSetKernelArg(simulate_bird_kernel, 3, sizeof(cl_mem), (void*)&dir_out);
+  err = clSetKernelArg(simulate_bird_kernel, delta_time_arg, sizeof(cl_float), (void*)&delta_time);
+
+  if (last_step_event != NULL) {
+    clReleaseEvent(last_step_event);
+  }
+
+  // Run the kernel
+  err = clEnqueueNDRangeKernel(queue_gpu, // command queue
+    simulate_bird_kernel, // kernel
+    1, // the number of dimensions used (1 to 3) (ex give 2 to work on a 2d matrix)
+    NULL, // useless param, always NULL
+    gpu_work_dims, // an array containing the size of each dimension for the entire kernel (for example m and n for a 2d matrix)
+    p_gpu_local_dims, // an array containing the size of each dimension for a single work group (a kernel is separated into work groups). NULL means let OpenCL automatically decide
+    tick_wait_event != NULL ? 1 : 0, // number of events to wait for
+    tick_wait_event != NULL ? &tick_wait_event : NULL, // events to wait for before the kernel runs
+    &last_step_event // event signalled when the kernel completes
+  );
+  profiler_gpu.Track(use_spatial_grid ? "kernel: simulate_bird_grid" : "kernel: simulate_bird_tiled", last_step_event);
+  if (tick_wait_event != NULL) {
+    clReleaseEvent(tick_wait_event);
+    tick_wait_event = NULL;
+  }
+
+  // The buffers written this step are read next step
+  current_buffer = 1 - current_buffer;
+}
+
+void OpenCLBackend::Fetch(double simulated_time, double prev_simulated_time) {
+  if (!tick_open) {
+    return;
+  }
+  cl_int err;
+  TickInFlight& tick = ticks_in_flight[next_tick_slot];
+  size_t bird_readback_size = sizeof(cl_float4) * state->num_of_birds;
+  bool keep_prev = prev_simulated_time < simulated_time;
+
+  // Only the last step of the tick is read back or drawn. The birds only have to reach the simulation state
+  // when there are neither render slots nor snapshots.
+  cl_mem pos_out = pos_buffers_gpu[current_buffer];
+  cl_mem dir_out = dir_buffers_gpu[current_buffer];
+  // The previous step's buffers are only needed while interpolating
+  cl_uint num_of_sources = keep_prev ? 4 : 2;
+  cl_mem sources[4] = { pos_out, dir_out, pos_buffers_gpu[1 - current_buffer], dir_buffers_gpu[1 - current_buffer] };
+  tick.read_back = render_slots == nullptr && snapshots == nullptr;
+  tick.keep_prev = keep_prev;
+  if (tick.read_back) {
+    err = clEnqueueReadBuffer(queue_gpu, pos_out, CL_FALSE, 0, bird_readback_size, tick.pos.data(), 1, &last_step_event, profiler_gpu.Event("read: positions"));
+    err = clEnqueueReadBuffer(queue_gpu, dir_out, CL_FALSE, 0, bird_readback_size, tick.dir.data(), 1, &last_step_event, profiler_gpu.Event("read: directions"));
+  }
+
+  // The render write slot is filled by one tick at a time, ticks enqueued while it is busy aren't drawn.
+  // The ping-pong buffers stay private to the simulation so the renderer never holds the buffer the next step reads.
+  tick.filled_render_slot = render_slots != nullptr && !render_slot_in_flight;
+  if (tick.filled_render_slot) {
+    BirdRenderTargets::Slot& slot = render_slots->WriteSlot();
+    if (gl_sharing) {
+      // Copied on the device
+      cl_mem* slot_buffers = render_slot_buffers[render_slots->handoff.write_slot];
+      err = clEnqueueAcquireGLObjects(queue_gpu, num_of_sources, slot_buffers, 1, &last_step_event, profiler_gpu.Event("acquire: render slot"));
+      for (cl_uint i = 0; i < num_of_sources; ++i) {
+        err = clEnqueueCopyBuffer(queue_gpu, sources[i], slot_buffers[i], 0, 0, bird_readback_size, 0, NULL, profiler_gpu.Event("copy: render slot"));
+      }
+      err = clEnqueueReleaseGLObjects(queue_gpu, num_of_sources, slot_buffers, 0, NULL, profiler_gpu.Event("release: render slot"));
+    }
+    else {
+      // Read back straight into the mapped vertex buffers, no staging copy and no upload by the renderer
+      for (cl_uint i = 0; i < num_of_sources; ++i) {
+        err = clEnqueueReadBuffer(queue_gpu, sources[i], CL_FALSE, 0, bird_readback_size, slot.mapped[i], 1, &last_step_event, profiler_gpu.Event("read: render slot"));
+      }
+    }
+    slot.simulated_time = simulated_time;
+    slot.prev_simulated_time = prev_simulated_time;
+    render_slot_in_flight = true;
+  }
+
+  // Without render slots the renderer draws whole ticks from the snapshots, filled by one tick at a time in the same way
+  tick.filled_snapshot = render_slots == nullptr && snapshots != nullptr && !snapshot_in_flight;
+  if (tick.filled_snapshot) {
+    BirdSnapshots::Snapshot& snapshot = snapshots->WriteSnapshot();
+    void* destinations[4] = { snapshot.pos.data, snapshot.dir.data, snapshot.prev_pos.data, snapshot.prev_dir.data };
+    for (cl_uint i = 0; i < num_of_sources; ++i) {
+      err = clEnqueueReadBuffer(queue_gpu, sources[i], CL_FALSE, 0, bird_readback_size, destinations[i], 1, &last_step_event, profiler_gpu.Event("read: snapshot"));
+    }
+    snapshot.simulated_time = simulated_time;
+    snapshot.prev_simulated_time = prev_simulated_time;
+    snapshot_in_flight = true;
+  }
+
+  // The averages thread averages the newest birds it has been handed, ticks enqueued while a hand over is in flight skip it
+  tick.filled_averages_birds = two_device_pipeline && !averages_birds_in_flight;
+  if (tick.filled_averages_birds) {
+    AveragesBirds& birds = averages_birds[averages_birds_handoff.write_slot];
+    err = clEnqueueReadBuffer(queue_gpu, pos_out, CL_FALSE, 0, bird_readback_size, birds.pos.data(), 1, &last_step_event, profiler_gpu.Event("read: averages positions"));
+    err = clEnqueueReadBuffer(queue_gpu, dir_out, CL_FALSE, 0, bird_readback_size, birds.dir.data(), 1, &last_step_event, profiler_gpu.Event("read: averages directions"));
+    averages_birds_in_flight = true;
+  }
+
+  // The queue is in order, the marker completes once everything above has
+  err = clEnqueueMarkerWithWaitList(queue_gpu, 0, NULL, &tick.done_event);
+  tick.simulated_time = simulated_time;
+  clFlush(queue_gpu);
+
+  clReleaseEvent(last_step_event);
+  last_step_event = NULL;
+  tick_open = false;
+
+  next_tick_slot = (next_tick_slot + 1) % SimulationState::max_ticks_in_flight;
+  num_of_ticks_in_flight += 1;
+}
+
+void OpenCLBackend::UpdateFlockAverages() {
+  cl_int err;
+  // Nothing was committed since the last update, the averages would be the same
+  if (!averages_birds_handoff.Acquire()) {
+    return;
+  }
+  const AveragesBirds& birds = averages_birds[averages_birds_handoff.read_slot];
+  size_t bird_upload_size = sizeof(cl_float4) * birds.pos.size();
+  {
+    PROFILE_ZONE("upload birds");
+    err = clEnqueueWriteBuffer(queue_cpu, pos_buffer_cpu, CL_TRUE, 0, bird_upload_size, birds.pos.data(), 0, NULL, profiler_cpu.Event("write: positions"));
+    err = clEnqueueWriteBuffer(queue_cpu, dir_buffer_cpu, CL_TRUE, 0, bird_upload_size, birds.dir.data(), 0, NULL, profiler_cpu.Event("write: directions"));
+  }
+
+  // Run the reduction kernels
+  {
+    PROFILE_ZONE("wait for device");
+    flock_averages.Enqueue(queue_cpu, profiler_cpu, pos_buffer_cpu, dir_buffer_cpu);
+    clFinish(queue_cpu);
+  }
+
+  PROFILE_ZONE("read back flock averages");
+  err = clEnqueueReadBuffer(queue_cpu, flock_avgs_buffer_cpu, CL_TRUE, 0, flock_avgs_buffer_size, averages_results[averages_results_handoff.write_slot].data(), 0, NULL, profiler_cpu.Event("read: flock averages"));
+  averages_results_handoff.Publish();
+  profiler_cpu.Collect();
+}
+
+void OpenCLBackend::Shutdown() {
+  if (queue_gpu != NULL) {
+    Commit(true);
+  }
+  // What was profiled since the last report
+  profiler_gpu.Report(std::cout);
+  profiler_cpu.Report(std::cout);
+  // Init may have stopped part way, only release what was created
+  cl_mem buffers[] = { pos_buffers_gpu[0], pos_buffers_gpu[1], dir_buffers_gpu[0], dir_buffers_gpu[1], bird_to_flock_buffer, flock_avgs_buffer_gpu, flock_ranges_buffer_gpu,
+    pos_buffer_cpu, dir_buffer_cpu, flock_avgs_buffer_cpu, flock_ranges_buffer_cpu };
+  for (cl_mem buffer : buffers) {
+    if (buffer != NULL) {
+      clReleaseMemObject(buffer);
+    }
+  }
+  for (auto& slot_buffers : render_slot_buffers) {
+    for (cl_mem buffer : slot_buffers) {
+      if (buffer != NULL) {
+        clReleaseMemObject(buffer);
+      }
+    }
+  }
+  grid.Release();
+  flock_averages.Release();
+  if (simulate_bird_kernel != NULL) {
+    clReleaseKernel(simulate_bird_kernel);
+  }
+  if (program_cpu != NULL) {
+    clReleaseProgram(program_cpu);
+  }
+  if (program_gpu != NULL) {
+    clReleaseProgram(program_gpu);
+  }
+  if (queue_cpu != NULL) {
+    clReleaseCommandQueue(queue_cpu);
+  }
+  if (cpu_context != NULL) {
+    clReleaseContext(cpu_context);
+  }
+  if (queue_gpu != NULL) {
+    clReleaseCommandQueue(queue_gpu);
+  }
+  if (gpu_context != NULL) {
+    clReleaseContext(gpu_context);
+  }
+}
@@ -0,0 +1,125 @@
+#pragma once
+#include <vector>
+#include <CL/opencl.h>
+#include "simulation_backend.h"
+#include "spatial_grid.h"
+#include "flock_averages.h"
+#include "program_cache.h"
+#include "device_selection.h"
+#include "command_profiler.h"
+
+// Simulation on the best scoring OpenCL device, see FindDevices. By default the flock averages are computed on the
+// same device, in the same queue as the simulation. With two_device_pipeline they are computed on a second (preferably
+// CPU) device instead, on the separate thread calling UpdateFlockAverages, and uploaded at the start of each tick.
+// The birds are handed to that thread, and the averages back, through TripleBufferSlots rather than the state.
+struct OpenCLBackend : SimulationBackend {
+  // Set before Init
+  bool two_device_pipeline = false;
+  // Built kernels are reused from this cache, which can outlive the backend. Null keeps a cache for this backend only.
+  ProgramCache* program_cache = nullptr;
+  // OpenGL context the GPU context is shared with (cl_khr_gl_sharing), see GLSharingContextProperties, empty to never share
+  std::vector<cl_context_properties> gl_share_properties;
+  // Devices are scored with a short micro-benchmark, otherwise by their compute units and clock only
+  bool benchmark_devices = true;
+  // Index of the simulation device in the device list, -1 picks the best scoring one
+  int requested_device = -1;
+  // Found and scored by Init unless already filled in, see FindDevices
+  std::vector<DeviceCandidate> devices;
+  // Every command is enqueued with an event and its device side durations are printed every few seconds, see
+  // CommandProfiler. Adds an event per command and a little queue overhead, off by default.
+  bool profile_commands = false;
+
+  std::string Name() const override { return "OpenCL"; }
+  bool Init(SimulationState& state) override;
+  bool AttachRenderSlots(BirdRenderTargets& render_slots) override;
+  bool SharesGLBuffers() const override { return gl_sharing; }
+  void Step(float delta_time) override;
+  void Fetch(double simulated_time, double prev_simulated_time) override;
+  void Commit(bool wait) override;
+  bool SeparateFlockAverages() const override { return two_device_pipeline; }
+  void UpdateFlockAverages() override;
+  void Shutdown() override;
+
+private:
+  // Host side of a tick that has been enqueued on the simulation queue. Unless the birds go to the render slots or
+  // snapshots, they are read back into pos/dir without blocking and copied into the simulation state once done_event
+  // has completed.
+  struct TickInFlight {
+    std::vector<cl_float4> pos;
+    std::vector<cl_float4> dir;
+    std::vector<cl_float4> flock_avgs; // copy of the flock averages uploaded this tick, must stay valid until the write completes
+    cl_event done_event = NULL; // marker after the last command of the tick
+    bool read_back = false; // pos/dir are being read back this tick
+    bool keep_prev = false; // the committed birds become the state's previous birds, for interpolation
+    bool filled_render_slot = false; // the tick copies its birds into the render slot
+    bool filled_snapshot = false; // the tick reads its birds back into the write snapshot
+    bool filled_averages_birds = false; // the tick reads its birds back for the flock averages thread
+    double simulated_time = 0; // simulated seconds at the end of this tick
+  };
+
+  // Birds handed to the flock averages thread
+  struct AveragesBirds {
+    std::vector<cl_float4> pos;
+    std::vector<cl_float4> dir;
+  };
+
+  void CommitOldestTick();
+
+  SimulationState* state = nullptr;
+
+  DeviceAssignment assignment;
+  cl_context gpu_context = NULL;
+  cl_context cpu_context = NULL;
+  cl_command_queue queue_gpu = NULL;
+  cl_command_queue queue_cpu = NULL;
+  cl_program program_gpu = NULL;
+  cl_program program_cpu = NULL;
+  ProgramCache own_program_cache; // used when program_cache is null
+  CommandProfiler profiler_gpu;
+  CommandProfiler profiler_cpu;
+  cl_kernel simulate_bird_kernel = NULL;
+
+  SpatialGrid grid;
+  FlockAverages flock_averages;
+
+  cl_mem pos_buffers_gpu[2]{}, dir_buffers_gpu[2]{}, bird_to_flock_buffer = NULL, flock_avgs_buffer_gpu = NULL, flock_ranges_buffer_gpu = NULL;
+  cl_mem pos_buffer_cpu = NULL, dir_buffer_cpu = NULL, flock_avgs_buffer_cpu = NULL, flock_ranges_buffer_cpu = NULL;
+  size_t bird_vectors_buffer_size = 0, flock_avgs_buffer_size = 0;
+
+  bool gl_sharing = false;
+
+  // Birds are double buffered, each step reads pos/dir_buffers_gpu[current_buffer] and writes the other pair
+  int current_buffer = 0;
+
+  // Small flocks use the tiled all-pairs kernel, the grid is only worth building for large flocks
+  bool use_spatial_grid = false;
+
+  // Arguments 0 to 3 are the in/out bird buffers and delta_time_arg is the step's delta time, set every step
+  cl_uint delta_time_arg = 0;
+  size_t gpu_work_dims[1]{};
+  size_t gpu_local_dims[1]{};
+  size_t* p_gpu_local_dims = NULL;
+
+  // Ticks are enqueued without blocking, up to max_ticks_in_flight of them can be queued on the device at once
+  TickInFlight ticks_in_flight[SimulationState::max_ticks_in_flight];
+  int next_tick_slot = 0;
+  int oldest_tick_slot = 0;
+  int num_of_ticks_in_flight = 0;
+  cl_event tick_wait_event = NULL; // the first step of the tick being enqueued waits on it
+  cl_event last_step_event = NULL; // simulate kernel of the last step enqueued
+  bool tick_open = false; // steps have been enqueued since the last Fetch
+
+  BirdRenderTargets* render_slots = nullptr;
+  cl_mem render_slot_buffers[BirdRenderTargets::num_of_slots][BirdRenderTargets::buffers_per_slot]{};
+  bool render_slot_in_flight = false; // a tick in flight is filling the render write slot
+  bool snapshot_in_flight = false; // a tick in flight is filling the write snapshot
+
+  // Two device pipeline only. Like the render slots, one tick at a time reads its birds back into the write slot of
+  // averages_birds and publishes them when committed. UpdateFlockAverages publishes its results in averages_results,
+  // the newest of which the next tick uploads.
+  AveragesBirds averages_birds[3];
+  TripleBufferSlots averages_birds_handoff;
+  bool averages_birds_in_flight = false;
+  std::vector<cl_float4> averages_results[3];
+  TripleBufferSlots averages_results_handoff;
+};
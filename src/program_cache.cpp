@@ -0,0 +1,168 @@
+#include "program_cache.h"
+#include "cl_helpers.h"
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#if defined(_WIN32)
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+namespace {
+
+// FNV-1a, unlike std::hash it gives the same value across runs and standard libraries, so it can name files
+uint64_t StableHash(const string& text) {
+  uint64_t hash = 14695981039346656037ull;
+  for (unsigned char c : text) {
+    hash = (hash ^ c) * 1099511628211ull;
+  }
+  return hash;
+}
+
+void MakeDirectory(const string& path) {
+#if defined(_WIN32)
+  _mkdir(path.c_str());
+#else
+  mkdir(path.c_str(), 0755);
+#endif
+}
+
+void PrintBuildLog(cl_program program, cl_device_id device, cl_int build_err) {
+  string log = ProgramBuildLog(program, device);
+  if (build_err != CL_SUCCESS || !log.empty()) {
+    std::cerr << "OpenCL program build " << (build_err == CL_SUCCESS ? "log" : "failed") << " (" << DeviceInfoString(device, CL_DEVICE_NAME) << "):" << std::endl << log << std::endl;
+  }
+}
+
+// NULL if the driver rejects the binary
+cl_program CreateFromBinary(cl_context context, cl_device_id device, const std::vector<unsigned char>& binary, const string& options) {
+  size_t size = binary.size();
+  const unsigned char* p_binary = binary.data();
+  cl_int binary_status;
+  cl_int err;
+  cl_program program = clCreateProgramWithBinary(context, 1, &device, &size, &p_binary, &binary_status, &err);
+  if (err != CL_SUCCESS || binary_status != CL_SUCCESS) {
+    if (program != NULL) {
+      clReleaseProgram(program);
+    }
+    return NULL;
+  }
+  // Binaries still have to be built (linked) before kernels can be created
+  err = clBuildProgram(program, 1, &device, options.c_str(), NULL, NULL);
+  if (err != CL_SUCCESS) {
+    clReleaseProgram(program);
+    return NULL;
+  }
+  return program;
+}
+
+// The program is built for a single device, so it has a single binary
+bool ProgramBinary(cl_program program, std::vector<unsigned char>& binary) {
+  size_t binary_size = 0;
+  clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES, sizeof(size_t), &binary_size, NULL);
+  if (binary_size == 0) {
+    return false;
+  }
+  binary.resize(binary_size);
+  unsigned char* p_binary = binary.data();
+  return clGetProgramInfo(program, CL_PROGRAM_BINARIES, sizeof(unsigned char*), &p_binary, NULL) == CL_SUCCESS;
+}
+
+}
+
+cl_program ProgramCache::Build(cl_context context, cl_device_id device, const char** sources, cl_uint count, const string& options) {
+  string joined_sources;
+  for (cl_uint i = 0; i < count; ++i) {
+    joined_sources += sources[i];
+  }
+  uint64_t source_hash = StableHash(joined_sources);
+  Key key(device, source_hash, options);
+
+  auto cached = binaries.find(key);
+  if (cached != binaries.end()) {
+    cl_program program = CreateFromBinary(context, device, cached->second, options);
+    if (program != NULL) {
+      binaries_reused += 1;
+      return program;
+    }
+    binaries.erase(cached);
+  }
+
+  // Everything that can change the compiled binary. The full key is stored in the file and compared on load,
+  // the file name is only its hash.
+  std::stringstream disk_key;
+  disk_key << DeviceInfoString(device, CL_DEVICE_NAME) << "\n" << DeviceInfoString(device, CL_DRIVER_VERSION) << "\n"
+    << std::hex << source_hash << "\n" << options;
+  string path;
+  std::vector<unsigned char> binary;
+  if (!binary_directory.empty()) {
+    std::stringstream file_name;
+    file_name << binary_directory << "/" << std::hex << std::setw(16) << std::setfill('0') << StableHash(disk_key.str()) << ".bin";
+    path = file_name.str();
+    if (LoadBinary(path, disk_key.str(), binary)) {
+      cl_program program = CreateFromBinary(context, device, binary, options);
+      if (program != NULL) {
+        binaries_loaded += 1;
+        binaries[key] = std::move(binary);
+        return program;
+      }
+      // Stale or rejected by the driver, rebuilt from source and overwritten
+    }
+  }
+
+  cl_int err;
+  cl_program program = clCreateProgramWithSource(context, count, sources, NULL, &err);
+  err = clBuildProgram(program, 1, &device, options.c_str(), NULL, NULL);
+  PrintBuildLog(program, device, err);
+  if (err != CL_SUCCESS) {
+    clReleaseProgram(program);
+    return NULL;
+  }
+  if (ProgramBinary(program, binary)) {
+    if (!path.empty()) {
+      StoreBinary(path, disk_key.str(), binary);
+    }
+    binaries[key] = std::move(binary);
+  }
+  return program;
+}
+
+// File layout: key length (uint64), key, binary length (uint64), binary
+bool ProgramCache::LoadBinary(const string& path, const string& disk_key, std::vector<unsigned char>& binary) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    return false;
+  }
+  uint64_t key_size = 0;
+  file.read((char*)&key_size, sizeof(key_size));
+  if (!file || key_size != disk_key.size()) {
+    return false;
+  }
+  string stored_key(key_size, '\0');
+  file.read(&stored_key[0], key_size);
+  uint64_t binary_size = 0;
+  file.read((char*)&binary_size, sizeof(binary_size));
+  if (!file || stored_key != disk_key || binary_size == 0) {
+    return false;
+  }
+  binary.resize(binary_size);
+  file.read((char*)binary.data(), binary_size);
+  return (bool)file;
+}
+
+void ProgramCache::StoreBinary(const string& path, const string& disk_key, const std::vector<unsigned char>& binary) {
+  MakeDirectory(binary_directory);
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  uint64_t key_size = disk_key.size();
+  uint64_t binary_size = binary.size();
+  file.write((const char*)&key_size, sizeof(key_size));
+  file.write(disk_key.data(), key_size);
+  file.write((const char*)&binary_size, sizeof(binary_size));
+  file.write((const char*)binary.data(), binary_size);
+  if (file) {
+    binaries_stored += 1;
+  }
+}
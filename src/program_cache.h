@@ -0,0 +1,34 @@
+#pragma once
+#include <CL/opencl.h>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
+
+using std::string;
+
+// Binaries of the programs built so far, keyed by device, sources and build options. The simulation
+// kernels are specialised for a parameter set through their build options, so going back to a parameter
+// set that was built before creates the program from its binary instead of compiling it again. Contexts
+// aren't part of the key, a cache that outlives a context is reused by the contexts created after it.
+// With a binary_directory, built programs are also stored on disk as CL_PROGRAM_BINARIES, keyed by
+// device name, driver version, source hash and build options, and later launches load them with
+// clCreateProgramWithBinary instead of compiling. Build logs are written to std::cerr.
+struct ProgramCache {
+  using Key = std::tuple<cl_device_id, uint64_t, string>; // device, hash of the sources, build options
+
+  std::map<Key, std::vector<unsigned char>> binaries;
+  string binary_directory; // empty disables the on-disk cache
+  int binaries_reused = 0;
+  int binaries_loaded = 0;
+  int binaries_stored = 0;
+
+  // Returns the program built from the sources with the options for the context, or NULL if it fails to
+  // build. The caller owns the program and releases it with clReleaseProgram.
+  cl_program Build(cl_context context, cl_device_id device, const char** sources, cl_uint count, const string& options);
+
+private:
+  bool LoadBinary(const string& path, const string& disk_key, std::vector<unsigned char>& binary);
+  void StoreBinary(const string& path, const string& disk_key, const std::vector<unsigned char>& binary);
+};
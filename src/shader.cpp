@@ -116,6 +116,10 @@ void Shader::Set3fv(string name, vec3 value) {
     int location = GetUniformPosition(name);
     glUniform3fv(location, 1, &value[0]);
 }
+void Shader::Set3fv(string name, vec3* values, int count) {
+    int location = GetUniformPosition(name);
+    glUniform3fv(location, count, &values[0][0]);
+}
 void Shader::Set4fv(string name, vec4 value) {
     int location = GetUniformPosition(name);
     glUniform4fv(location, 1, &value[0]);
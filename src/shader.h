@@ -22,6 +22,7 @@ struct Shader {
 	void SetMatrix4fv(string, mat4);
 	void Set2fv(string, vec2);
 	void Set3fv(string, vec3);
+	void Set3fv(string, vec3*, int);
 	void Set4fv(string, vec4);
 	void Set1f(string, float);
 	void Set1i(string, int);
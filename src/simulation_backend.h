@@ -0,0 +1,48 @@
+#pragma once
+#include <string>
+#include "simulation_state.h"
+#include "bird_render_targets.h"
+#include "bird_snapshots.h"
+#include "stage_timings.h"
+
+// Compute engine driven by the simulation thread. A tick is one or more Step calls followed by Fetch, which hands
+// the birds of the last step to the renderer, either through the render slots (see AttachRenderSlots), as snapshots
+// or by copying them into the state's bird arrays. Engines may run ahead of the host, Commit completes the ticks
+// handed over so far.
+struct SimulationBackend {
+  // When set, engines add the time of their internal stages to it
+  StageTimings* stage_timings = nullptr;
+  // When set, ticks that don't go through render slots are published here instead of copied into the state's bird
+  // arrays, which the renderer would otherwise read while they are being written. Set before the first Step.
+  BirdSnapshots* snapshots = nullptr;
+
+  virtual ~SimulationBackend() {}
+
+  // Shown in the window title
+  virtual std::string Name() const = 0;
+
+  // Creates the engine's resources for state and uploads its birds and flocks.
+  // Returns false if the engine can't run on this host, after writing why to std::cerr.
+  virtual bool Init(SimulationState& state) = 0;
+  // Hands each tick's birds over in render_slots instead of the state's bird arrays, writing into their mapped
+  // pointers if they are persistently mapped and into the OpenGL buffers themselves otherwise.
+  // Returns false if the engine can't write to the slots, the birds then keep going through the state.
+  virtual bool AttachRenderSlots(BirdRenderTargets& render_slots) = 0;
+  // True if the engine can write into the render slots' OpenGL buffers without mapping them
+  virtual bool SharesGLBuffers() const { return false; }
+
+  // Simulates one step of delta_time seconds
+  virtual void Step(float delta_time) = 0;
+  // Hands the birds of the last step to the renderer, simulated_time seconds into the simulation. If
+  // prev_simulated_time is earlier, the birds of the step before are handed over too for interpolation.
+  virtual void Fetch(double simulated_time, double prev_simulated_time) = 0;
+  // Completes the ticks fetched so far that have finished simulating, or all of them when wait is set
+  virtual void Commit(bool wait) = 0;
+
+  // The flock averages are computed by UpdateFlockAverages on a separate thread, instead of in every step
+  virtual bool SeparateFlockAverages() const { return false; }
+  virtual void UpdateFlockAverages() {}
+
+  // Releases the engine's resources, with no tick left in flight
+  virtual void Shutdown() = 0;
+};
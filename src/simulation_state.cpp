@@ -1,31 +1,98 @@
 #include "simulation_state.h"
 #include <string>
 #include <iostream>
-#include <thread>
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include <iomanip>
 
-using std::thread;
+SimulationState::SimulationState(int num_of_birds, int num_of_flocks) {
+  this->num_of_flocks = std::min(std::max(num_of_flocks, (int)min_flocks), (int)max_flocks);
+  max_birds_in_flock = std::max(1, (num_of_birds + this->num_of_flocks - 1) / this->num_of_flocks);
+  min_birds_in_flock = std::max(1, max_birds_in_flock - 1);
+  max_birds = this->num_of_flocks * max_birds_in_flock;
+  bird_pos.Allocate(max_birds);
+  bird_dir.Allocate(max_birds);
+  prev_bird_pos.Allocate(max_birds);
+  prev_bird_dir.Allocate(max_birds);
+  bird_to_flock.Allocate(max_birds);
+}
+
+// -D options defining the constants the simulation kernels are specialised for. Floats are written with
+// enough digits to round trip, so the device uses exactly the host's values.
+std::string SimulationState::KernelBuildOptions() const {
+  std::ostringstream options;
+  options << std::showpoint << std::setprecision(9);
+  auto define = [&](const char* name, float value) {
+    options << "-D " << name << "=" << value << "f ";
+  };
+  define("WORLD_X_START", world_size_x_start);
+  define("WORLD_X_END", world_size_x_end);
+  define("WORLD_Y_START", world_size_y_start);
+  define("WORLD_Y_END", world_size_y_end);
+  define("WORLD_Z_START", world_size_z_start);
+  define("WORLD_Z_END", world_size_z_end);
+  define("BIRD_MOV_SPEED", bird_mov_speed);
+  define("BIRD_ROT_SPEED", bird_rot_speed);
+  define("SEPARATION_DIST", separation_dist);
+  define("SEPARATION_FORCE_COEFFICIENT", separation_force_coefficient);
+  define("ALIGNMENT_COEFFICIENT", flock_alignment_coefficient);
+  define("COHESION_COEFFICIENT", flock_cohesion_coefficient);
+  return options.str();
+}
+
+double SimulationState::GridCellsPerFlock() const {
+  double cells_x = std::ceil((world_size_x_end - world_size_x_start + 2 * grid_margin) / (double)separation_dist);
+  double cells_y = std::ceil((world_size_y_end - world_size_y_start + 2 * grid_margin) / (double)separation_dist);
+  double cells_z = std::ceil((world_size_z_end - world_size_z_start + 2 * grid_margin) / (double)separation_dist);
+  return cells_x * cells_y * cells_z;
+}
+
+bool SimulationState::ValidBehaviour() const {
+  const float values[] = { bird_mov_speed, bird_rot_speed, separation_dist, separation_force_coefficient, flock_alignment_coefficient, flock_cohesion_coefficient };
+  for (float value : values) {
+    if (!std::isfinite(value) || value < 0) {
+      std::cerr << "Bird behaviour values must be finite and at least 0" << std::endl;
+      return false;
+    }
+  }
+  // The grid cells are separation_dist wide
+  if (!(separation_dist > 0) || GridCellsPerFlock() > max_grid_cells_per_flock) {
+    std::cerr << "--separation-dist must be greater than 0 and give at most " << max_grid_cells_per_flock << " grid cells per flock" << std::endl;
+    return false;
+  }
+  return true;
+}
 
 void SimulationState::CreateFlocks() {
-  num_of_flocks = rand() % (max_flocks - min_flocks + 1) + min_flocks;
+  num_of_birds = 0;
+  // Flocks are packed back to back so kernels can be launched over num_of_birds without gaps
   for (int i = 0; i < num_of_flocks; ++i) {
     flocks[i] = Flock();
-    flock_ranges[i * 2] = i * max_birds_in_flock;
-    int num_of_birds = CreateBirds(flock_ranges[i * 2], i);
-    flock_ranges[i * 2 + 1] = flock_ranges[i * 2] + num_of_birds;
+    flock_ranges[i * 2] = num_of_birds;
+    num_of_birds += CreateBirds(flock_ranges[i * 2], i);
+    flock_ranges[i * 2 + 1] = num_of_birds;
+  }
+}
+
+int SimulationState::LargestFlockSize() {
+  int largest = 0;
+  for (int i = 0; i < num_of_flocks; ++i) {
+    largest = std::max(largest, (int)(flock_ranges[i * 2 + 1] - flock_ranges[i * 2]));
   }
+  return largest;
 }
 
 int SimulationState::CreateBirds(int start_index, int flock) {
   int num_of_birds = rand() % (max_birds_in_flock - min_birds_in_flock + 1) + min_birds_in_flock;
   //int num_of_birds = 3;
   for (int i = start_index; i < start_index + num_of_birds; ++i) {
-    Bird b{};
     float pos_x = (rand() / (float)RAND_MAX) * (world_size_x_end - world_size_x_start) + world_size_x_start;
     float pos_y = (rand() / (float)RAND_MAX) * (world_size_y_end - world_size_y_start) + world_size_y_start;
     float pos_z = (rand() / (float)RAND_MAX) * (world_size_z_end - world_size_z_start) + world_size_z_start;
-    b.pos = vec3{ pos_x, pos_y, pos_z };
-    b.dir = glm::normalize(b.pos); // Just so birds don't have the same initial direction.
-    birds[i] = b;
+    vec3 pos = vec3{ pos_x, pos_y, pos_z };
+    bird_pos[i] = vec4(pos, 0.0f);
+    bird_dir[i] = vec4(glm::normalize(pos), 0.0f); // Just so birds don't have the same initial direction.
     bird_to_flock[i] = flock;
   }
   return num_of_birds;
@@ -1,20 +1,21 @@
 #pragma once
 #include <glm.hpp>
-#include <thread>
+#include <chrono>
+#include <string>
+#include <type_traits>
 #include <CL/opencl.h>
+#include "aligned_array.h"
 
 using glm::vec3;
-using std::thread;
-
-struct Bird {
-  vec3 pos;
-  vec3 dir;
-};
+using glm::vec4;
 
+// Flock averages are padded to vec4 to match the float4 layout of the bird buffers
 struct Flock {
-  vec3 avgdir{ 0,0,0 };
-  vec3 avgpos{ 0,0,0 };
+  vec4 avgdir{ 0,0,0,0 };
+  vec4 avgpos{ 0,0,0,0 };
 };
+// The flocks are uploaded and read back as raw float4 pairs, see flock_avgs in the kernels
+static_assert(sizeof(Flock) == 2 * sizeof(cl_float4) && std::is_standard_layout<Flock>::value, "Flock must be laid out as two float4");
 
 struct SimulationState {
   static constexpr float world_size_x_start = -50.0f;
@@ -23,32 +24,54 @@ struct SimulationState {
   static constexpr float world_size_y_end = 50.0f;
   static constexpr float world_size_z_start = 20.0f;
   static constexpr float world_size_z_end = 75.0f;
-  static const int min_flocks = 7;
-  static const int max_flocks = 7;
-  static const int min_birds_in_flock = 571;
-  static const int max_birds_in_flock = 572;
-  static const int max_birds = max_flocks * max_birds_in_flock;
-  static constexpr float bird_mov_speed = 2.0f;
-  static constexpr float bird_rot_speed = 0.4f; // in rad per second
-  static constexpr float separation_dist = 4.0f;
-  static constexpr float separation_force_coefficient = 2.0f;
-  static constexpr float flock_alignment_coefficient = 0.5f;
-  static constexpr float flock_cohesion_coefficient = 0.5f;
+  static const int min_flocks = 1;
+  static const int max_flocks = 7; // flock colours in bird_v.glsl and the grid's flock dimension are sized for this many
+  static const int default_birds = 4004;
+  static constexpr float grid_margin = 16.0f; // birds overshoot the world bounds before turning around, birds outside the grid are clamped into its edge cells
+  static const int grid_min_flock_size = 2048; // smaller flocks use the tiled all-pairs separation kernel instead of the grid
+  static const int max_grid_cells_per_flock = 1 << 21; // bounds the grid buffers, rules out separation distances below about 0.9
+  static const int reduction_birds_per_work_item = 8; // birds each work item sums in the first flock averages reduction stage
+  static const int max_ticks_in_flight = 2; // simulation ticks that can be queued on the device before the host waits for the oldest
+
+  // Bird behaviour, baked into the kernels at build time (see KernelBuildOptions)
+  float bird_mov_speed = 2.0f;
+  float bird_rot_speed = 0.4f; // in rad per second
+  float separation_dist = 4.0f;
+  float separation_force_coefficient = 2.0f;
+  float flock_alignment_coefficient = 0.5f;
+  float flock_cohesion_coefficient = 0.5f;
+
+  // Bird capacity is chosen at startup, each flock gets max_birds_in_flock or one bird less
+  int min_birds_in_flock;
+  int max_birds_in_flock;
+  int max_birds;
 
   Flock flocks[max_flocks]{};
-  Bird birds[max_birds]{};
-  cl_uint bird_to_flock[max_birds]{};
+  // Birds are stored as a structure of arrays of float4 (w unused) so kernels can use full width vector loads
+  // and the renderer can consume the arrays as they are. The arrays hold max_birds birds.
+  AlignedArray<vec4> bird_pos;
+  AlignedArray<vec4> bird_dir;
+  // The tick committed before bird_pos/bird_dir, only kept with a fixed timestep to interpolate between them when drawing
+  AlignedArray<vec4> prev_bird_pos;
+  AlignedArray<vec4> prev_bird_dir;
+  double committed_time = 0; // simulated seconds of bird_pos/bird_dir
+  double prev_committed_time = 0; // simulated seconds of prev_bird_pos/prev_bird_dir
+  std::chrono::steady_clock::time_point commit_clock_time{};
+  AlignedArray<cl_uint> bird_to_flock;
   cl_uint flock_ranges[max_flocks * 2];
   int num_of_flocks;
+  int num_of_birds;
 
-  thread threads[max_flocks]{};
-  bool flock_update_requests[max_flocks]{};
-  bool simulation_active = true;
-
-  float delta_time = 0;
-  float last_frame_time = 0;
-
+  // Allocates room for at least num_of_birds birds, spread evenly over num_of_flocks flocks (clamped to min_flocks..max_flocks)
+  SimulationState(int num_of_birds = default_birds, int num_of_flocks = max_flocks);
   void CreateFlocks();
+  std::string KernelBuildOptions() const;
+  // Cells of one flock's separation grid, whose cells are separation_dist wide. In double, so it can't overflow.
+  double GridCellsPerFlock() const;
+  // False if a behaviour value is negative or not finite, separation_dist is 0 or it makes more grid cells than
+  // max_grid_cells_per_flock, after writing why to std::cerr
+  bool ValidBehaviour() const;
+  int LargestFlockSize();
   int CreateBirds(int start_index, int flock);
 };
 
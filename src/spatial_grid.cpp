@@ -0,0 +1,116 @@
+#include "spatial_grid.h"
+#include "cl_helpers.h"
+#include <cmath>
+
+bool SpatialGrid::Init(cl_context context, cl_device_id device, cl_program program, SimulationState& state, cl_mem bird_to_flock_buffer) {
+  cl_int err;
+
+  cell_size = state.separation_dist;
+  origin = { SimulationState::world_size_x_start - SimulationState::grid_margin, SimulationState::world_size_y_start - SimulationState::grid_margin, SimulationState::world_size_z_start - SimulationState::grid_margin, 0.0f };
+  dims.s[0] = (cl_int)std::ceil((SimulationState::world_size_x_end - SimulationState::world_size_x_start + 2 * SimulationState::grid_margin) / cell_size);
+  dims.s[1] = (cl_int)std::ceil((SimulationState::world_size_y_end - SimulationState::world_size_y_start + 2 * SimulationState::grid_margin) / cell_size);
+  dims.s[2] = (cl_int)std::ceil((SimulationState::world_size_z_end - SimulationState::world_size_z_start + 2 * SimulationState::grid_margin) / cell_size);
+  dims.s[3] = SimulationState::max_flocks;
+  num_of_cells = dims.s[0] * dims.s[1] * dims.s[2] * dims.s[3];
+
+  count_kernel = clCreateKernel(program, "count_grid_cells", &err);
+  if (!CheckCL(err, "clCreateKernel (count_grid_cells)")) {
+    return false;
+  }
+  scan_kernel = clCreateKernel(program, "scan_grid_cells", &err);
+  if (!CheckCL(err, "clCreateKernel (scan_grid_cells)")) {
+    return false;
+  }
+  scatter_kernel = clCreateKernel(program, "scatter_grid_birds", &err);
+  if (!CheckCL(err, "clCreateKernel (scatter_grid_birds)")) {
+    return false;
+  }
+
+  bird_cells_buffer = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(cl_uint) * state.max_birds, NULL, &err);
+  if (!CheckCL(err, "clCreateBuffer (grid bird cells)")) {
+    return false;
+  }
+  bird_cell_offsets_buffer = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(cl_uint) * state.max_birds, NULL, &err);
+  if (!CheckCL(err, "clCreateBuffer (grid bird cell offsets)")) {
+    return false;
+  }
+  cell_counts_buffer = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(cl_uint) * num_of_cells, NULL, &err);
+  if (!CheckCL(err, "clCreateBuffer (grid cell counts)")) {
+    return false;
+  }
+  cell_starts_buffer = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(cl_uint) * num_of_cells, NULL, &err);
+  if (!CheckCL(err, "clCreateBuffer (grid cell starts)")) {
+    return false;
+  }
+  sorted_pos_buffer = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(cl_float4) * state.max_birds, NULL, &err);
+  if (!CheckCL(err, "clCreateBuffer (grid sorted positions)")) {
+    return false;
+  }
+
+  // The scan runs as a single work group
+  scan_local_size = PowerOfTwoWorkGroupSize(scan_kernel, device, 256);
+
+  err = clSetKernelArg(count_kernel, 1, sizeof(cl_mem), (void*)&bird_to_flock_buffer);
+  err = clSetKernelArg(count_kernel, 2, sizeof(cl_mem), (void*)&bird_cells_buffer);
+  err = clSetKernelArg(count_kernel, 3, sizeof(cl_mem), (void*)&bird_cell_offsets_buffer);
+  err = clSetKernelArg(count_kernel, 4, sizeof(cl_mem), (void*)&cell_counts_buffer);
+  err = clSetKernelArg(count_kernel, 5, sizeof(cl_float4), (void*)&origin);
+  err = clSetKernelArg(count_kernel, 6, sizeof(cl_int4), (void*)&dims);
+  err = clSetKernelArg(count_kernel, 7, sizeof(cl_float), (void*)&cell_size);
+
+  err = clSetKernelArg(scan_kernel, 0, sizeof(cl_mem), (void*)&cell_counts_buffer);
+  err = clSetKernelArg(scan_kernel, 1, sizeof(cl_mem), (void*)&cell_starts_buffer);
+  err = clSetKernelArg(scan_kernel, 2, sizeof(cl_uint), (void*)&num_of_cells);
+  err = clSetKernelArg(scan_kernel, 3, sizeof(cl_uint) * scan_local_size, NULL);
+
+  err = clSetKernelArg(scatter_kernel, 1, sizeof(cl_mem), (void*)&bird_cells_buffer);
+  err = clSetKernelArg(scatter_kernel, 2, sizeof(cl_mem), (void*)&bird_cell_offsets_buffer);
+  err = clSetKernelArg(scatter_kernel, 3, sizeof(cl_mem), (void*)&cell_starts_buffer);
+  err = clSetKernelArg(scatter_kernel, 4, sizeof(cl_mem), (void*)&sorted_pos_buffer);
+  return true;
+}
+
+// Sets the grid buffers and dimensions on simulate_bird_grid, starting at argument index first_arg
+void SpatialGrid::SetSimulateArgs(cl_kernel simulate_kernel, cl_uint first_arg) {
+  cl_int err;
+  err = clSetKernelArg(simulate_kernel, first_arg, sizeof(cl_mem), (void*)&bird_cells_buffer);
+  err = clSetKernelArg(simulate_kernel, first_arg + 1, sizeof(cl_mem), (void*)&bird_cell_offsets_buffer);
+  err = clSetKernelArg(simulate_kernel, first_arg + 2, sizeof(cl_mem), (void*)&cell_counts_buffer);
+  err = clSetKernelArg(simulate_kernel, first_arg + 3, sizeof(cl_mem), (void*)&cell_starts_buffer);
+  err = clSetKernelArg(simulate_kernel, first_arg + 4, sizeof(cl_mem), (void*)&sorted_pos_buffer);
+  err = clSetKernelArg(simulate_kernel, first_arg + 5, sizeof(cl_float4), (void*)&origin);
+  err = clSetKernelArg(simulate_kernel, first_arg + 6, sizeof(cl_int4), (void*)&dims);
+  err = clSetKernelArg(simulate_kernel, first_arg + 7, sizeof(cl_float), (void*)&cell_size);
+}
+
+// Enqueues the counting sort of the birds in pos_buffer into the grid. Must be enqueued before simulate_bird_grid on the same queue.
+void SpatialGrid::Build(cl_command_queue queue, CommandProfiler& profiler, size_t num_of_birds, cl_mem pos_buffer) {
+  cl_int err;
+  err = clSetKernelArg(count_kernel, 0, sizeof(cl_mem), (void*)&pos_buffer);
+  err = clSetKernelArg(scatter_kernel, 0, sizeof(cl_mem), (void*)&pos_buffer);
+
+  cl_uint zero = 0;
+  size_t bird_work_dims[1]{ num_of_birds };
+  size_t scan_work_dims[1]{ scan_local_size };
+
+  err = clEnqueueFillBuffer(queue, cell_counts_buffer, &zero, sizeof(cl_uint), 0, sizeof(cl_uint) * num_of_cells, 0, NULL, profiler.Event("fill: grid cell counts"));
+  err = clEnqueueNDRangeKernel(queue, count_kernel, 1, NULL, bird_work_dims, NULL, 0, NULL, profiler.Event("kernel: grid count"));
+  err = clEnqueueNDRangeKernel(queue, scan_kernel, 1, NULL, scan_work_dims, scan_work_dims, 0, NULL, profiler.Event("kernel: grid scan"));
+  err = clEnqueueNDRangeKernel(queue, scatter_kernel, 1, NULL, bird_work_dims, NULL, 0, NULL, profiler.Event("kernel: grid scatter"));
+}
+
+void SpatialGrid::Release() {
+  // Init may have stopped part way, only release what was created
+  cl_mem buffers[] = { bird_cells_buffer, bird_cell_offsets_buffer, cell_counts_buffer, cell_starts_buffer, sorted_pos_buffer };
+  for (cl_mem buffer : buffers) {
+    if (buffer != NULL) {
+      clReleaseMemObject(buffer);
+    }
+  }
+  cl_kernel kernels[] = { count_kernel, scan_kernel, scatter_kernel };
+  for (cl_kernel kernel : kernels) {
+    if (kernel != NULL) {
+      clReleaseKernel(kernel);
+    }
+  }
+}
@@ -0,0 +1,27 @@
+#pragma once
+#include <CL/opencl.h>
+#include "simulation_state.h"
+#include "command_profiler.h"
+
+// Uniform grid used by the separation pass. Birds are counting sorted into cells of size
+// separation_dist every tick, see spatial_grid_kernel in kernels.h. Birds further apart than
+// that never interact, so only neighbouring cells need to be visited.
+struct SpatialGrid {
+  cl_float4 origin{};
+  cl_int4 dims{}; // cells per axis in x, y, z, number of flocks in w
+  cl_float cell_size = 1.0f;
+  cl_uint num_of_cells = 0;
+  size_t scan_local_size = 1;
+
+  cl_kernel count_kernel = NULL;
+  cl_kernel scan_kernel = NULL;
+  cl_kernel scatter_kernel = NULL;
+
+  cl_mem bird_cells_buffer = NULL, bird_cell_offsets_buffer = NULL, cell_counts_buffer = NULL, cell_starts_buffer = NULL, sorted_pos_buffer = NULL;
+
+  // Returns false if a kernel or buffer can't be created, after writing why to std::cerr
+  bool Init(cl_context context, cl_device_id device, cl_program program, SimulationState& state, cl_mem bird_to_flock_buffer);
+  void SetSimulateArgs(cl_kernel simulate_kernel, cl_uint first_arg);
+  void Build(cl_command_queue queue, CommandProfiler& profiler, size_t num_of_birds, cl_mem pos_buffer);
+  void Release();
+};
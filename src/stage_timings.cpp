@@ -0,0 +1,32 @@
+#include "stage_timings.h"
+#include <algorithm>
+#include <iomanip>
+
+void StageTimings::Add(const char* name, double seconds) {
+  auto stage = std::find_if(stages.begin(), stages.end(), [&](const Stage& s) { return s.name == name; });
+  if (stage == stages.end()) {
+    stages.push_back(Stage());
+    stage = stages.end() - 1;
+    stage->name = name;
+    stage->min = seconds;
+  }
+  stage->total += seconds;
+  stage->min = std::min(stage->min, seconds);
+  stage->max = std::max(stage->max, seconds);
+  stage->count += 1;
+}
+
+void StageTimings::Print(std::ostream& out, double total_seconds) const {
+  size_t name_width = 5;
+  for (const Stage& stage : stages) {
+    name_width = std::max(name_width, stage.name.size());
+  }
+  out << std::left << std::setw(name_width) << "stage" << std::right << std::setw(10) << "mean ms" << std::setw(10) << "min ms" << std::setw(10) << "max ms" << std::setw(8) << "share" << std::endl;
+  out << std::fixed << std::setprecision(3);
+  for (const Stage& stage : stages) {
+    out << std::left << std::setw(name_width) << stage.name << std::right
+      << std::setw(10) << stage.total / stage.count * 1000 << std::setw(10) << stage.min * 1000 << std::setw(10) << stage.max * 1000
+      << std::setw(7) << std::setprecision(1) << (total_seconds > 0 ? stage.total / total_seconds * 100 : 0) << "%" << std::setprecision(3) << std::endl;
+  }
+  out << std::defaultfloat;
+}
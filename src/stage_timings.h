@@ -0,0 +1,26 @@
+#pragma once
+#include <chrono>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Wall clock time spent in named stages, accumulated over many ticks. Stages are listed in the order
+// they were first timed. Not thread safe, stages are timed by the thread driving the backend.
+struct StageTimings {
+  using clock = std::chrono::steady_clock;
+
+  struct Stage {
+    std::string name;
+    double total = 0; // in seconds
+    double min = 0;
+    double max = 0;
+    long long count = 0;
+  };
+
+  std::vector<Stage> stages;
+
+  void Add(const char* name, double seconds);
+  void Add(const char* name, clock::time_point start) { Add(name, std::chrono::duration<double>(clock::now() - start).count()); }
+  // One line per stage with its mean, min and max in milliseconds, and its share of total_seconds
+  void Print(std::ostream& out, double total_seconds) const;
+};
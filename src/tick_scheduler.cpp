@@ -0,0 +1,51 @@
+#include "tick_scheduler.h"
+#include <algorithm>
+#include <thread>
+
+using std::chrono::duration;
+using std::chrono::duration_cast;
+
+TickScheduler::TickScheduler(double ticks_per_second) {
+  interval = 1.0 / ticks_per_second;
+  start_time = clock::now();
+  next_deadline = start_time;
+}
+
+// Seconds since the scheduler was created
+double TickScheduler::Now() {
+  return duration<double>(clock::now() - start_time).count();
+}
+
+// Blocks until the next tick is due and returns the current time in seconds since the scheduler was created
+double TickScheduler::WaitForNextTick() {
+  clock::time_point now = clock::now();
+  clock::duration spin_tail_duration = duration_cast<clock::duration>(duration<double>(spin_tail));
+  if (next_deadline - now > spin_tail_duration) {
+    clock::time_point wake_time = next_deadline - spin_tail_duration;
+    std::this_thread::sleep_until(wake_time);
+    now = clock::now();
+    // Grow the spin tail right away when a sleep overshoots it, shrink it slowly otherwise
+    double oversleep = duration<double>(now - wake_time).count();
+    if (oversleep > spin_tail) {
+      spin_tail = std::min(oversleep + min_spin_tail, interval);
+    }
+    else {
+      spin_tail = std::max(spin_tail * 0.99, min_spin_tail);
+    }
+  }
+  while (now < next_deadline) {
+    std::this_thread::yield();
+    now = clock::now();
+  }
+
+  ticks += 1;
+  clock::duration interval_duration = duration_cast<clock::duration>(duration<double>(interval));
+  if (now - next_deadline > interval_duration) {
+    missed_deadlines += 1;
+    next_deadline = now + interval_duration;
+  }
+  else {
+    next_deadline += interval_duration;
+  }
+  return duration<double>(now - start_time).count();
+}
@@ -0,0 +1,23 @@
+#pragma once
+#include <chrono>
+
+// Paces a loop at a fixed rate without busy waiting. WaitForNextTick sleeps until shortly before the
+// next deadline and spins only for the remaining spin_tail. The spin tail adapts to how late the
+// sleeps actually wake up, as sleep granularity differs a lot between platforms.
+// Deadlines missed by more than a whole interval are counted and skipped rather than caught up on.
+struct TickScheduler {
+  using clock = std::chrono::steady_clock;
+
+  static constexpr double min_spin_tail = 0.0005; // in seconds
+
+  double interval;
+  double spin_tail = 0.002;
+  clock::time_point start_time;
+  clock::time_point next_deadline;
+  long long ticks = 0;
+  long long missed_deadlines = 0;
+
+  TickScheduler(double ticks_per_second);
+  double WaitForNextTick();
+  double Now();
+};
@@ -0,0 +1,34 @@
+#pragma once
+#include <atomic>
+
+// Lock-free handoff of three buffer slots between one producer and one consumer thread. The producer
+// fills write_slot and publishes it, the consumer takes the newest published slot as read_slot.
+// Neither side ever waits for the other, a slot published before the consumer took the previous one
+// simply replaces it.
+struct TripleBufferSlots {
+  static const int fresh_bit = 4; // set in ready_slot while it holds a slot the consumer hasn't taken yet
+
+  std::atomic<int> ready_slot{ 1 };
+  int write_slot = 0; // owned by the producer
+  int read_slot = 2; // owned by the consumer
+
+  // Producer: makes write_slot the newest slot and returns the slot to fill next
+  int Publish() {
+    write_slot = ready_slot.exchange(write_slot | fresh_bit, std::memory_order_acq_rel) & ~fresh_bit;
+    return write_slot;
+  }
+
+  // Consumer: true if a slot was published since the last Acquire
+  bool HasNew() const {
+    return (ready_slot.load(std::memory_order_acquire) & fresh_bit) != 0;
+  }
+
+  // Consumer: takes the newest published slot as read_slot, returns false if nothing new was published
+  bool Acquire() {
+    if (!HasNew()) {
+      return false;
+    }
+    read_slot = ready_slot.exchange(read_slot, std::memory_order_acq_rel) & ~fresh_bit;
+    return true;
+  }
+};
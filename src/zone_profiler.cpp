@@ -0,0 +1,113 @@
+#include "zone_profiler.h"
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+using clock_type = std::chrono::steady_clock;
+
+std::atomic<bool> zone_profiler_enabled{ false };
+
+namespace {
+
+struct Zone {
+  const char* name;
+  clock_type::time_point start;
+  clock_type::time_point end;
+};
+
+// Written only by its thread. Threads' buffers outlive them, so the trace can be written after they've been joined.
+struct ThreadZones {
+  int id = 0;
+  std::string name;
+  std::vector<Zone> zones; // ring buffer of zones_per_thread zones
+  std::atomic<unsigned long long> count{ 0 }; // zones recorded so far, the newest is at (count - 1) % zones_per_thread
+};
+
+std::mutex threads_mutex;
+std::vector<std::unique_ptr<ThreadZones>> threads;
+clock_type::time_point trace_start;
+thread_local ThreadZones* this_thread_zones = nullptr;
+
+// Registered on the thread's first zone or name, the only time a thread takes the lock
+ThreadZones& ThisThreadZones() {
+  if (this_thread_zones == nullptr) {
+    std::unique_ptr<ThreadZones> thread_zones(new ThreadZones());
+    thread_zones->zones.resize(zones_per_thread);
+    std::lock_guard<std::mutex> lock(threads_mutex);
+    thread_zones->id = (int)threads.size() + 1;
+    thread_zones->name = "thread " + std::to_string(thread_zones->id);
+    this_thread_zones = thread_zones.get();
+    threads.push_back(std::move(thread_zones));
+  }
+  return *this_thread_zones;
+}
+
+double Microseconds(clock_type::time_point time) {
+  return std::chrono::duration<double, std::micro>(time - trace_start).count();
+}
+
+void WriteJsonString(std::ostream& out, const std::string& value) {
+  out << '"';
+  for (char c : value) {
+    if (c == '"' || c == '\\') {
+      out << '\\';
+    }
+    out << c;
+  }
+  out << '"';
+}
+
+}
+
+void EnableZoneProfiler() {
+  trace_start = clock_type::now();
+  zone_profiler_enabled.store(true);
+}
+
+void SetZoneThreadName(const char* name) {
+  if (!zone_profiler_enabled.load(std::memory_order_relaxed)) {
+    return;
+  }
+  ThreadZones& thread_zones = ThisThreadZones();
+  std::lock_guard<std::mutex> lock(threads_mutex);
+  thread_zones.name = name;
+}
+
+void RecordZone(const char* name, clock_type::time_point start, clock_type::time_point end) {
+  ThreadZones& thread_zones = ThisThreadZones();
+  unsigned long long count = thread_zones.count.load(std::memory_order_relaxed);
+  thread_zones.zones[count % zones_per_thread] = Zone{ name, start, end };
+  thread_zones.count.store(count + 1, std::memory_order_release);
+}
+
+bool WriteChromeTrace(const std::string& path) {
+  std::ofstream out(path);
+  if (!out) {
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(threads_mutex);
+  out << std::fixed << std::setprecision(3);
+  out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[" << std::endl;
+  bool first = true;
+  for (const std::unique_ptr<ThreadZones>& thread_zones : threads) {
+    out << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << thread_zones->id << ",\"args\":{\"name\":";
+    WriteJsonString(out, thread_zones->name);
+    out << "}}";
+    first = false;
+
+    // Oldest kept zone first
+    unsigned long long count = thread_zones->count.load(std::memory_order_acquire);
+    unsigned long long first_zone = count > zones_per_thread ? count - zones_per_thread : 0;
+    for (unsigned long long i = first_zone; i < count; ++i) {
+      const Zone& zone = thread_zones->zones[i % zones_per_thread];
+      out << ",\n{\"name\":";
+      WriteJsonString(out, zone.name);
+      out << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << thread_zones->id << ",\"ts\":" << Microseconds(zone.start)
+        << ",\"dur\":" << std::chrono::duration<double, std::micro>(zone.end - zone.start).count() << "}";
+    }
+  }
+  out << std::endl << "]}" << std::endl;
+  return (bool)out;
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <string>
+
+// Timeline of named zones on every thread, written as Chrome trace event JSON (chrome://tracing or ui.perfetto.dev)
+// to see which thread waits on which. Each thread records its zones into its own ring buffer without locking, only
+// the newest zones_per_thread zones of a thread are kept. Nothing is recorded until EnableZoneProfiler, a zone then
+// costs a relaxed atomic load. Defining DISABLE_ZONE_PROFILER compiles the zones out altogether.
+
+const size_t zones_per_thread = 1 << 16;
+
+extern std::atomic<bool> zone_profiler_enabled;
+
+void EnableZoneProfiler();
+// Names the calling thread in the trace, threads are numbered in the order they record their first zone otherwise.
+// Ignored before EnableZoneProfiler.
+void SetZoneThreadName(const char* name);
+// Writes the recorded zones to path. Must be called once the profiled threads have stopped recording.
+bool WriteChromeTrace(const std::string& path);
+
+void RecordZone(const char* name, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end);
+
+// Records the scope it lives in as a zone. name must stay valid until the trace is written, a string literal.
+struct ProfileZone {
+  const char* name;
+  std::chrono::steady_clock::time_point start;
+
+  explicit ProfileZone(const char* name) : name(zone_profiler_enabled.load(std::memory_order_relaxed) ? name : nullptr) {
+    if (this->name != nullptr) {
+      start = std::chrono::steady_clock::now();
+    }
+  }
+  ~ProfileZone() {
+    if (name != nullptr) {
+      RecordZone(name, start, std::chrono::steady_clock::now());
+    }
+  }
+  ProfileZone(const ProfileZone&) = delete;
+  ProfileZone& operator=(const ProfileZone&) = delete;
+};
+
+#define PROFILE_ZONE_CONCAT_(a, b) a##b
+#define PROFILE_ZONE_CONCAT(a, b) PROFILE_ZONE_CONCAT_(a, b)
+#if defined(DISABLE_ZONE_PROFILER)
+#define PROFILE_ZONE(name) ((void)0)
+#else
+// Zone from here to the end of the enclosing scope
+#define PROFILE_ZONE(name) ProfileZone PROFILE_ZONE_CONCAT(profile_zone_, __LINE__)(name)
+#endif